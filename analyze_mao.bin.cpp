@@ -0,0 +1,323 @@
+#include "graph_io.hpp"
+#include "mao.hpp"
+
+#include <cmath>
+#include <iomanip>
+
+using namespace std;
+
+namespace {
+
+// Rough costs of the basic operations of the counting methods in nanoseconds,
+// measured on a desktop machine. The estimates are upper bounds for the
+// amount of work, so the actual running times are often much smaller.
+const double NanosPerStatePair = 100.0;
+const double NanosPerWordOp = 5.0;
+const double NanosPerMAO = 20.0;
+
+double log2Factorial(int n) {
+    return lgamma(n + 1.0) / log(2.0);
+}
+
+// log2(2^a + 2^b)
+double log2Add(double a, double b) {
+    if(a < b) {
+        swap(a, b);
+    }
+    if(b == -HUGE_VAL) {
+        return a;
+    }
+    return a + log2(1.0 + exp2(b - a));
+}
+
+// Upper bound for log2 of the number of states in a Dist with k output
+// vertices: each state is an ordering of the vertices and a subset of them.
+double log2StateBound(int k) {
+    return log2Factorial(k) + k;
+}
+
+double fromLog2(double x) {
+    return x >= log2(1e300) ? 1e300 : exp2(x);
+}
+
+// Whether the number of edges matches one of the special cases solved in
+// closed form by the recursive methods.
+bool isClosedFormCase(int n, int64_t e) {
+    int64_t a = (int64_t)n * (n - 1) / 2;
+    return n <= 1 || e == n - 1 || e == n || e >= a - 2;
+}
+
+// Upper bound for log2 of the number of MAOs of a chain component. An MAO
+// orders every clique totally, and it is determined by these orders, which
+// have to agree on the separators of the clique tree; thus there are at most
+// prod |C|! / prod |S|! of them. The closed form cases are counted exactly.
+double log2MAOBound(const ChainComponentAnalysis& comp) {
+    int n = comp.vertCount;
+    int64_t e = comp.edgeCount;
+    int64_t a = (int64_t)n * (n - 1) / 2;
+    if(n <= 1) {
+        return 0.0;
+    } else if(e == n - 1) {
+        return log2((double)n);
+    } else if(e == n) {
+        return log2(2.0 * n);
+    } else if(e == a - 2) {
+        return log2((double)n * (n - 1) - 4.0) + log2Factorial(n - 3);
+    } else if(e == a - 1) {
+        return log2Factorial(n - 2) + log2(2.0 * n - 3.0);
+    } else if(e == a) {
+        return log2Factorial(n);
+    }
+    
+    double ret = 0.0;
+    for(int size : comp.cliqueSizes) {
+        ret += log2Factorial(size);
+    }
+    for(int size : comp.separatorSizes) {
+        ret -= log2Factorial(size);
+    }
+    return min(ret, log2Factorial(n));
+}
+
+// The estimates of the tree decomposition DP follow the sizes of its merges.
+// The other methods only have worst-case bounds that depend on the numbers of
+// MAOs and vertex subsets; they are often many orders of magnitude above the
+// actual cost, so they are reported as worst_case_seconds and
+// worst_case_bytes and never used to pick the fastest method.
+struct Estimate {
+    double log2Nanos = -HUGE_VAL;
+    double log2Bytes = -HUGE_VAL;
+    bool worstCase = false;
+    
+    void addTime(double log2Work, double nanosPerUnit) {
+        log2Nanos = log2Add(log2Nanos, log2Work + log2(nanosPerUnit));
+    }
+    void maxMemory(double log2Bytes2) {
+        log2Bytes = max(log2Bytes, log2Bytes2);
+    }
+    void addMemory(double log2Bytes2) {
+        log2Bytes = log2Add(log2Bytes, log2Bytes2);
+    }
+};
+
+struct ComponentSummary {
+    int maxVertCount = 0;
+    int depth = 0;
+    double log2MaxStates = -HUGE_VAL;
+    double log2TotalStates = -HUGE_VAL;
+    Estimate treeDecomposition;
+};
+
+ComponentSummary summarize(const ChainComponentAnalysis& comp) {
+    ComponentSummary ret;
+    
+    const vector<ChainComponentAnalysis::MergeNode>& nodes = comp.mergeTree;
+    vector<int> depth(nodes.size(), 0);
+    for(int i = 0; i < (int)nodes.size(); ++i) {
+        const ChainComponentAnalysis::MergeNode& node = nodes[i];
+        if(node.left != -1) {
+            ret.maxVertCount = max(ret.maxVertCount, node.vertCount);
+            depth[i] = 1 + max(depth[node.left], depth[node.right]);
+        } else {
+            ret.maxVertCount = max(ret.maxVertCount, node.outputCount);
+        }
+        ret.depth = max(ret.depth, depth[i]);
+    }
+    
+    int param = 1 << ceilLog2(max(ret.maxVertCount, 1));
+    // Up to 16 vertices, the states are ranked into 8-byte keys
+    double stateBytes = 80.0 + (param <= 16 ? 8.0 : (param <= 256 ? param : 4 * param) + 8.0 * bitSetParam(param));
+    
+    for(const ChainComponentAnalysis::MergeNode& node : nodes) {
+        double states = log2StateBound(node.outputCount);
+        ret.log2MaxStates = max(ret.log2MaxStates, states);
+        ret.log2TotalStates = log2Add(ret.log2TotalStates, states);
+        
+        // The distributions of the leaves are generated on demand while
+        // merging them, so they cost neither time nor memory by themselves
+        if(node.left != -1) {
+            double live = states;
+            for(int child : {node.left, node.right}) {
+                if(nodes[child].left != -1) {
+                    live = log2Add(live, log2StateBound(nodes[child].outputCount));
+                }
+            }
+            int leftCount = nodes[node.left].outputCount;
+            int rightCount = nodes[node.right].outputCount;
+            double pairs = log2StateBound(leftCount) + rightCount;
+            ret.treeDecomposition.addTime(pairs, NanosPerStatePair);
+            ret.treeDecomposition.maxMemory(live + log2(stateBytes));
+        }
+    }
+    
+    // The merge tree itself stays in memory during the DP
+    ret.treeDecomposition.addMemory(log2(nodes.size() * (64.0 + 16.0 * bitSetParam(param))));
+    
+    return ret;
+}
+
+void printEstimate(const string& method, const Estimate* estimate, bool first) {
+    cout << (first ? "\n" : ",\n");
+    cout << "    {\"method\": \"" << method << "\"";
+    if(estimate) {
+        const char* kind = estimate->worstCase ? "worst_case" : "estimated";
+        cout << ", \"supported\": true";
+        cout << ", \"" << kind << "_seconds\": " << fromLog2(estimate->log2Nanos - log2(1e9));
+        cout << ", \"" << kind << "_bytes\": " << fromLog2(estimate->log2Bytes) << "}";
+    } else {
+        cout << ", \"supported\": false}";
+    }
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    cin.sync_with_stdio(false);
+    cin.tie(nullptr);
+    
+    removeStackLimit();
+    
+    if(argc != 1) {
+        cerr << "Usage: (no arguments)\n";
+        cerr << "Reads graphs from standard input and writes an analysis of the cost of\n";
+        cerr << "counting their MAOs as JSON to standard output.\n";
+        fail("Invalid command line");
+    }
+    
+    cout << setprecision(4);
+    
+    // The opening bracket is only written with the first graph, so that
+    // nothing is written if reading the input fails
+    bool firstGraph = true;
+    readInputGraphs(STDIN_FILENO, [&](const GraphData& graphData) {
+        shared_ptr<const SparseGraph> sparse = graphData.sparseGraph();
+        int64_t undirectedEdges = sparse->undirectedPart().edgeCount() / 2;
+        int64_t directedEdges = sparse->edgeCount() - 2 * undirectedEdges;
+        
+        vector<ChainComponentAnalysis> comps = analyzeChainComponents(graphData);
+        
+        Estimate treeDecomposition;
+        Estimate dynamicProgramming;
+        Estimate heEtAl;
+        Estimate enumeration;
+        dynamicProgramming.worstCase = true;
+        heEtAl.worstCase = true;
+        enumeration.worstCase = true;
+        double log2MAOTotal = 0.0;
+        int64_t totalVertCount = 0;
+        
+        cout << (firstGraph ? "[\n" : ",\n");
+        firstGraph = false;
+        cout << "  {\"vertices\": " << graphData.size();
+        cout << ", \"undirected_edges\": " << undirectedEdges;
+        cout << ", \"directed_edges\": " << directedEdges;
+        cout << ", \"components\": [";
+        for(int i = 0; i < (int)comps.size(); ++i) {
+            const ChainComponentAnalysis& comp = comps[i];
+            ComponentSummary summary = summarize(comp);
+            int n = comp.vertCount;
+            int64_t e = comp.edgeCount;
+            int leafCount = 0;
+            for(const ChainComponentAnalysis::MergeNode& node : comp.mergeTree) {
+                leafCount += node.left == -1;
+            }
+            
+            cout << (i ? ",\n" : "\n");
+            cout << "    {\"vertices\": " << n << ", \"edges\": " << e;
+            cout << ", \"cliques\": " << comp.cliqueSizes.size();
+            cout << ", \"max_clique_size\": " << *max_element(comp.cliqueSizes.begin(), comp.cliqueSizes.end());
+            cout << ", \"merge_tree_nodes\": " << comp.mergeTree.size();
+            cout << ", \"merge_tree_leaves\": " << leafCount;
+            cout << ", \"merge_tree_depth\": " << summary.depth;
+            cout << ", \"max_vert_count\": " << summary.maxVertCount;
+            cout << ", \"max_states_bound\": " << fromLog2(summary.log2MaxStates);
+            cout << ", \"total_states_bound\": " << fromLog2(summary.log2TotalStates) << "}";
+            
+            treeDecomposition.log2Nanos = log2Add(treeDecomposition.log2Nanos, summary.treeDecomposition.log2Nanos);
+            treeDecomposition.maxMemory(summary.treeDecomposition.log2Bytes);
+            
+            // The recursive methods try every vertex as the root in every
+            // subproblem. Without memoization, He et al. make at most n calls
+            // per MAO, by induction over the chain components left by each
+            // root, as every root gives at least one MAO. The DP memoizes the
+            // subproblems by vertex subset.
+            double log2WordOps = log2((double)n * n * max(n / 64, 1));
+            double log2MAOs = log2MAOBound(comp);
+            if(isClosedFormCase(n, e)) {
+                dynamicProgramming.addTime(log2WordOps, NanosPerWordOp);
+                heEtAl.addTime(log2WordOps, NanosPerWordOp);
+            } else {
+                dynamicProgramming.addTime(n + log2WordOps, NanosPerWordOp);
+                dynamicProgramming.maxMemory(n + log2(64.0 + 8.0 * max(n / 64, 1)));
+                heEtAl.addTime(log2MAOs + log2((double)n) + log2WordOps, NanosPerWordOp);
+            }
+            heEtAl.maxMemory(log2((double)n * n * n / 4 + 64));
+            log2MAOTotal += log2MAOs;
+            totalVertCount += n;
+        }
+        cout << (comps.empty() ? "" : "\n  ") << "]";
+        
+        enumeration.addTime(log2MAOTotal + log2((double)max(totalVertCount, (int64_t)1)), NanosPerMAO);
+        enumeration.maxMemory(log2((double)graphData.size() * graphData.size() / 4 + 64));
+        
+        // All methods keep the input graph in memory
+        double log2InputBytes = log2(16.0 * (graphData.size() + sparse->edgeCount()) + 64.0);
+        for(Estimate* estimate : {&treeDecomposition, &dynamicProgramming, &heEtAl, &enumeration}) {
+            estimate->addMemory(log2InputBytes);
+        }
+        
+        auto estimateFor = [&](Z (*method)(const GraphData&)) -> const Estimate* {
+            if(method == countMAOUsingTreeDecompositionDP) {
+                return &treeDecomposition;
+            } else if(graphData.size() > DefaultMaxGraphSize) {
+                // Only the tree decomposition DP has a sparse pipeline
+                return nullptr;
+            } else if(method == countMAOUsingEnumeration) {
+                return &enumeration;
+            } else if(method == countMAOUsingHeEtAl2015 || method == countMAOUsingHeEtAl2016) {
+                return &heEtAl;
+            } else if(method == countMAOUsingDynamicProgramming) {
+                return &dynamicProgramming;
+            } else {
+                return &treeDecomposition;
+            }
+        };
+        
+        // The portfolio finishes with its fastest method, but all of them use
+        // memory at the same time. The worst-case bounds only count if no
+        // method in the portfolio has an actual estimate.
+        Estimate portfolio;
+        portfolio.log2Nanos = HUGE_VAL;
+        portfolio.worstCase = true;
+        for(const auto& p : countMAOMethods) {
+            if(find(portfolioMethods.begin(), portfolioMethods.end(), p.first) != portfolioMethods.end()) {
+                const Estimate* estimate = estimateFor(p.second);
+                if(estimate && portfolio.worstCase && !estimate->worstCase) {
+                    portfolio = Estimate();
+                    portfolio.log2Nanos = HUGE_VAL;
+                }
+                if(estimate && estimate->worstCase == portfolio.worstCase) {
+                    portfolio.log2Nanos = min(portfolio.log2Nanos, estimate->log2Nanos);
+                    portfolio.addMemory(estimate->log2Bytes);
+                }
+            }
+        }
+        
+        cout << ",\n  \"methods\": [";
+        bool firstMethod = true;
+        for(const auto& p : countMAOMethods) {
+            const Estimate* estimate;
+            if(p.second == countMAOUsingPortfolio) {
+                estimate = graphData.size() > DefaultMaxGraphSize ? &treeDecomposition : &portfolio;
+            } else {
+                estimate = estimateFor(p.second);
+            }
+            printEstimate(p.first, estimate, firstMethod);
+            firstMethod = false;
+        }
+        cout << "\n  ]}";
+    });
+    cout << (firstGraph ? "[" : "") << "\n]\n";
+    
+    return 0;
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <cstdlib>
+#include <new>
+
+// Memory use of the arenas of the current thread.
+struct ArenaStats {
+    // Bytes in the chunks owned by live arenas, and the maximum of that
+    uint64_t bytesInUse = 0;
+    uint64_t peakBytesInUse = 0;
+    
+    // Total number of bytes handed out by arenas
+    uint64_t bytesAllocated = 0;
+};
+inline thread_local ArenaStats arenaStats;
+
+namespace arena {
+
+// Chunks have power-of-two sizes between 2^MinChunkBits and 2^MaxChunkBits
+// bytes, except for single allocations larger than that.
+const int MinChunkBits = 12;
+const int MaxChunkBits = 26;
+const int ChunkClassCount = 48;
+
+struct Chunk {
+    Chunk* next;
+    int sizeClass;
+    
+    char* data() {
+        return (char*)this + sizeof(Chunk);
+    }
+    size_t size() const {
+        return ((size_t)1 << sizeClass) - sizeof(Chunk);
+    }
+};
+static_assert(sizeof(Chunk) % alignof(max_align_t) == 0, "Chunk data must be aligned");
+
+// Chunks released by the arenas of one thread, kept for reuse by later arenas
+// so that a finished Dist does not give its pages back to the system just for
+// the next one to fault them in again.
+class ChunkCache {
+public:
+    static const size_t MaxCachedBytes = (size_t)256 << 20;
+    
+    ChunkCache() : cachedBytes_(0) {
+        for(Chunk*& head : free_) {
+            head = nullptr;
+        }
+    }
+    
+    ChunkCache(const ChunkCache&) = delete;
+    ChunkCache& operator=(const ChunkCache&) = delete;
+    
+    ~ChunkCache() {
+        for(Chunk* head : free_) {
+            while(head != nullptr) {
+                Chunk* next = head->next;
+                std::free(head);
+                head = next;
+            }
+        }
+    }
+    
+    Chunk* take(int sizeClass) {
+        assert(sizeClass < ChunkClassCount);
+        Chunk* chunk = free_[sizeClass];
+        if(chunk != nullptr) {
+            free_[sizeClass] = chunk->next;
+            cachedBytes_ -= (size_t)1 << sizeClass;
+        } else {
+            chunk = (Chunk*)malloc((size_t)1 << sizeClass);
+            if(chunk == nullptr) {
+                throw bad_alloc();
+            }
+            chunk->sizeClass = sizeClass;
+        }
+        chunk->next = nullptr;
+        return chunk;
+    }
+    
+    void give(Chunk* chunk) {
+        size_t bytes = (size_t)1 << chunk->sizeClass;
+        if(cachedBytes_ + bytes > MaxCachedBytes) {
+            std::free(chunk);
+        } else {
+            chunk->next = free_[chunk->sizeClass];
+            free_[chunk->sizeClass] = chunk;
+            cachedBytes_ += bytes;
+        }
+    }
+    
+    size_t cachedBytes() const {
+        return cachedBytes_;
+    }
+    
+private:
+    Chunk* free_[ChunkClassCount];
+    size_t cachedBytes_;
+};
+
+inline thread_local ChunkCache chunkCache;
+
+}
+
+// Bump allocator that frees all its memory at once on reset() or destruction.
+// The chunks are taken from and returned to the cache of the current thread,
+// so an arena must only be used by one thread at a time; parallel work uses
+// separate arenas in each thread.
+class Arena {
+public:
+    Arena()
+        : chunks_(nullptr),
+          pos_(nullptr),
+          end_(nullptr),
+          bytesInUse_(0),
+          nextSizeClass_(arena::MinChunkBits)
+    { }
+    
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    
+    ~Arena() {
+        reset();
+    }
+    
+    void* allocate(size_t bytes, size_t align) {
+        assert(align != 0 && (align & (align - 1)) == 0 && align <= alignof(max_align_t));
+        uintptr_t p = ((uintptr_t)pos_ + align - 1) & ~(uintptr_t)(align - 1);
+        if(pos_ == nullptr || p + bytes > (uintptr_t)end_) {
+            addChunk_(bytes);
+            p = (uintptr_t)pos_;
+        }
+        pos_ = (char*)(p + bytes);
+        arenaStats.bytesAllocated += bytes;
+        return (void*)p;
+    }
+    
+    // Releases all the memory of the arena.
+    void reset() {
+        while(chunks_ != nullptr) {
+            arena::Chunk* next = chunks_->next;
+            arena::chunkCache.give(chunks_);
+            chunks_ = next;
+        }
+        arenaStats.bytesInUse -= bytesInUse_;
+        bytesInUse_ = 0;
+        pos_ = nullptr;
+        end_ = nullptr;
+        nextSizeClass_ = arena::MinChunkBits;
+    }
+    
+    // Bytes in the chunks owned by the arena.
+    size_t bytesInUse() const {
+        return bytesInUse_;
+    }
+    
+private:
+    arena::Chunk* chunks_;
+    char* pos_;
+    char* end_;
+    size_t bytesInUse_;
+    int nextSizeClass_;
+    
+    void addChunk_(size_t bytes) {
+        // The chunk sizes double up to the maximum so that the number of
+        // chunks stays logarithmic while the waste stays bounded
+        int sizeClass = nextSizeClass_;
+        while((((size_t)1 << sizeClass) - sizeof(arena::Chunk)) < bytes) {
+            ++sizeClass;
+        }
+        nextSizeClass_ = min(max(nextSizeClass_, sizeClass) + 1, arena::MaxChunkBits);
+        
+        arena::Chunk* chunk = arena::chunkCache.take(sizeClass);
+        chunk->next = chunks_;
+        chunks_ = chunk;
+        pos_ = chunk->data();
+        end_ = pos_ + chunk->size();
+        
+        size_t chunkBytes = (size_t)1 << sizeClass;
+        bytesInUse_ += chunkBytes;
+        arenaStats.bytesInUse += chunkBytes;
+        arenaStats.peakBytesInUse = max(arenaStats.peakBytesInUse, arenaStats.bytesInUse);
+    }
+};
+
+// Allocator for node-based containers that allocates from an arena shared by
+// the copies of the allocator and frees nothing before the arena dies with
+// the last copy. A default-constructed allocator creates a new arena, so each
+// container gets its own arena, and its memory is released as a whole when the
+// container is destroyed.
+template <typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+    typedef true_type propagate_on_container_move_assignment;
+    typedef true_type propagate_on_container_swap;
+    
+    ArenaAllocator() : arena_(make_shared<Arena>()) { }
+    
+    explicit ArenaAllocator(shared_ptr<Arena> arena) : arena_(move(arena)) { }
+    
+    template <class X>
+    ArenaAllocator(const ArenaAllocator<X>& x) noexcept : arena_(x.arena_) { }
+    
+    // A copy of a container gets an arena of its own, so that it does not
+    // keep the memory of the original alive
+    ArenaAllocator select_on_container_copy_construction() const {
+        return ArenaAllocator();
+    }
+    
+    T* allocate(size_t n) {
+        return (T*)arena_->allocate(n * sizeof(T), alignof(T));
+    }
+    void deallocate(T*, size_t) noexcept { }
+    
+    const shared_ptr<Arena>& arena() const {
+        return arena_;
+    }
+    
+    template <typename X>
+    bool operator==(const ArenaAllocator<X>& x) const {
+        return arena_.get() == x.arena_.get();
+    }
+    
+    template <typename X>
+    bool operator!=(const ArenaAllocator<X>& x) const {
+        return arena_.get() != x.arena_.get();
+    }
+    
+private:
+    shared_ptr<Arena> arena_;
+    
+    template <typename X>
+    friend class ArenaAllocator;
+};
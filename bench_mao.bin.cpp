@@ -0,0 +1,269 @@
+#include "mao.hpp"
+
+#include <chrono>
+#include <ctime>
+#include <fstream>
+
+using namespace std;
+
+namespace {
+
+// Families of random UCCGs. Each generator is called with the number of
+// vertices and the k-tree width parameter.
+const vector<pair<string, GraphData (*)(int, int)>> graphFamilies = {
+    {"sparse", [](int n, int) {
+        GraphData ret;
+        selectGraphParam(n, [&](auto sel) {
+            int e = max(n - 1, min(2 * n, n * (n - 1) / 2));
+            ret = GraphData(Graph<sel.Val>::randomConnectedChordal(n, e));
+        });
+        return ret;
+    }},
+    {"dense", [](int n, int) {
+        GraphData ret;
+        selectGraphParam(n, [&](auto sel) {
+            int e = max(n - 1, min(8 * n, n * (n - 1) / 2));
+            ret = GraphData(Graph<sel.Val>::randomConnectedChordal(n, e));
+        });
+        return ret;
+    }},
+    {"tree", [](int n, int) {
+        GraphData ret;
+        selectGraphParam(n, [&](auto sel) {
+            ret = GraphData(Graph<sel.Val>::randomConnectedChordal(n, max(n - 1, 0)));
+        });
+        return ret;
+    }},
+    {"ktree", [](int n, int k) {
+        GraphData ret;
+        selectGraphParam(n, [&](auto sel) {
+            ret = GraphData(Graph<sel.Val>::randomKTree(n, k));
+        });
+        return ret;
+    }},
+    {"nearclique", [](int n, int) {
+        GraphData ret;
+        selectGraphParam(n, [&](auto sel) {
+            int e = max(n - 1, n * (n - 1) / 2 - n / 4);
+            ret = GraphData(Graph<sel.Val>::randomConnectedChordal(n, e));
+        });
+        return ret;
+    }}
+};
+
+double cpuSeconds() {
+    timespec ts;
+    if(clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts)) {
+        fail("Getting CPU time failed");
+    }
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// Resets the peak resident set size of the process if the kernel supports it.
+void resetPeakRSS() {
+    ofstream("/proc/self/clear_refs") << "5";
+}
+
+// Peak resident set size in kilobytes.
+int64_t peakRSS() {
+    ifstream status("/proc/self/status");
+    string line;
+    while(getline(status, line)) {
+        if(line.substr(0, 6) == "VmHWM:") {
+            return fromString<int64_t>(line.substr(6));
+        }
+    }
+    rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage)) {
+        fail("Getting resource usage failed");
+    }
+    return usage.ru_maxrss;
+}
+
+struct Result {
+    string family;
+    int vertCount;
+    int64_t edgeCount;
+    int rep;
+    uint64_t seed;
+    string method;
+    Z count;
+    double wallSeconds;
+    double cpuSeconds;
+    int64_t peakRSSKB;
+    CountMAOStats stats;
+};
+
+void printCSVHeader() {
+    cout << "family,vertices,edges,rep,seed,method,count,wall_seconds,cpu_seconds,peak_rss_kb,table_count,max_table_size,total_table_size\n";
+}
+
+void printCSV(const Result& r) {
+    cout << r.family << "," << r.vertCount << "," << r.edgeCount << ",";
+    cout << r.rep << "," << r.seed << ",\"" << r.method << "\"," << r.count << ",";
+    cout << r.wallSeconds << "," << r.cpuSeconds << "," << r.peakRSSKB << ",";
+    cout << r.stats.tableCount << "," << r.stats.maxTableSize << "," << r.stats.totalTableSize << endl;
+}
+
+void printJSON(const Result& r, bool first) {
+    cout << (first ? "[\n" : ",\n");
+    cout << "  {\"family\": \"" << r.family << "\", \"vertices\": " << r.vertCount;
+    cout << ", \"edges\": " << r.edgeCount << ", \"rep\": " << r.rep;
+    cout << ", \"seed\": " << r.seed << ", \"method\": \"" << r.method << "\"";
+    cout << ", \"count\": \"" << r.count << "\", \"wall_seconds\": " << r.wallSeconds;
+    cout << ", \"cpu_seconds\": " << r.cpuSeconds << ", \"peak_rss_kb\": " << r.peakRSSKB;
+    cout << ", \"table_count\": " << r.stats.tableCount;
+    cout << ", \"max_table_size\": " << r.stats.maxTableSize;
+    cout << ", \"total_table_size\": " << r.stats.totalTableSize << "}" << flush;
+}
+
+template <typename T>
+const pair<string, T>& findByPrefix(const vector<pair<string, T>>& options, const string& prefix, const char* what) {
+    const pair<string, T>* ret = nullptr;
+    for(const auto& p : options) {
+        if(p.first.substr(0, prefix.size()) == prefix) {
+            if(ret != nullptr) {
+                fail("Ambiguous ", what, " name '", prefix, "'");
+            }
+            ret = &p;
+        }
+    }
+    if(ret == nullptr) {
+        fail(what, " '", prefix, "' not found");
+    }
+    return *ret;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    cin.sync_with_stdio(false);
+    cin.tie(nullptr);
+    
+    removeStackLimit();
+    
+    uint64_t seed = 0;
+    int repCount = 3;
+    int k = 3;
+    bool json = false;
+    vector<int> sizes;
+    vector<pair<string, GraphData (*)(int, int)>> families;
+    vector<pair<string, Z (*)(const GraphData&)>> methods;
+    for(int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if(arg == "--seed" && hasValue) {
+            seed = fromString<uint64_t>(argv[++i]);
+        } else if(arg == "--repeat" && hasValue) {
+            repCount = fromString<int>(argv[++i]);
+        } else if(arg == "--k" && hasValue) {
+            k = fromString<int>(argv[++i]);
+        } else if(arg == "--size" && hasValue) {
+            sizes.push_back(fromString<int>(argv[++i]));
+        } else if(arg == "--family" && hasValue) {
+            families.push_back(findByPrefix(graphFamilies, argv[++i], "Graph family"));
+        } else if(arg == "--format" && hasValue) {
+            string format = argv[++i];
+            if(format != "csv" && format != "json") {
+                fail("Unknown output format '", format, "'");
+            }
+            json = format == "json";
+        } else if(arg.substr(0, 2) == "--") {
+            cerr << "Usage: [--seed <seed>] [--repeat <count>] [--format csv|json] ";
+            cerr << "[--family <name>]... [--size <vertices>]... [--k <k>] <method name prefix>...\n";
+            cerr << "Available graph families:\n";
+            for(const auto& p : graphFamilies) {
+                cerr << "  " << p.first << "\n";
+            }
+            cerr << "Available methods:\n";
+            for(const auto& p : countMAOMethods) {
+                cerr << "  \"" << p.first << "\"\n";
+            }
+            fail("Invalid command line");
+        } else {
+            methods.push_back(findByPrefix(countMAOMethods, arg, "Method"));
+        }
+    }
+    
+    if(families.empty()) {
+        families = graphFamilies;
+    }
+    if(sizes.empty()) {
+        sizes = {8, 16, 24};
+    }
+    if(methods.empty()) {
+        methods.push_back(findByPrefix(countMAOMethods, "Dynamic Programming", "Method"));
+    }
+    if(repCount < 1) {
+        fail("Number of repetitions must be positive");
+    }
+    for(int n : sizes) {
+        if(n < 0 || n > DefaultMaxGraphSize) {
+            fail("Graph size ", n, " is out of range");
+        }
+    }
+    
+    if(!json) {
+        printCSVHeader();
+    }
+    bool first = true;
+    for(const auto& family : families) {
+        for(int n : sizes) {
+            for(int rep = 0; rep < repCount; ++rep) {
+                // The seed of each graph depends only on its parameters, so
+                // that any subset of the benchmark can be reproduced
+                uint64_t graphSeed = seed;
+                for(char c : family.first) {
+                    hashCombine(graphSeed, c);
+                }
+                hashCombine(graphSeed, n);
+                hashCombine(graphSeed, k);
+                hashCombine(graphSeed, rep);
+                seedRng(graphSeed);
+                
+                GraphData graphData = family.second(n, k);
+                int64_t edgeCount = 0;
+                graphData.accessGraph([&](auto graph) {
+                    for(int v = 0; v < graph.size(); ++v) {
+                        edgeCount += graph.edgesOut(v).count();
+                    }
+                });
+                edgeCount /= 2;
+                
+                for(const auto& method : methods) {
+                    Result result;
+                    result.family = family.first;
+                    result.vertCount = n;
+                    result.edgeCount = edgeCount;
+                    result.rep = rep;
+                    result.seed = graphSeed;
+                    result.method = method.first;
+                    
+                    countMAOStats = CountMAOStats();
+                    resetPeakRSS();
+                    auto wallStart = chrono::steady_clock::now();
+                    double cpuStart = cpuSeconds();
+                    
+                    result.count = method.second(graphData);
+                    
+                    result.cpuSeconds = cpuSeconds() - cpuStart;
+                    result.wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - wallStart).count();
+                    result.peakRSSKB = peakRSS();
+                    result.stats = countMAOStats;
+                    
+                    if(json) {
+                        printJSON(result, first);
+                    } else {
+                        printCSV(result);
+                    }
+                    first = false;
+                }
+            }
+        }
+    }
+    if(json) {
+        cout << (first ? "[" : "\n") << "]\n";
+    }
+    
+    return 0;
+}
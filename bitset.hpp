@@ -250,6 +250,16 @@ public:
         return words_[0];
     }
     
+    uint64_t word(int w) const {
+        assert(w >= 0 && w < W);
+        return words_[w];
+    }
+    
+    void setWord(int w, uint64_t x) {
+        assert(w >= 0 && w < W);
+        words_[w] = x;
+    }
+    
     int min() const {
         for(int w = 0; w < W; ++w) {
             if(words_[w]) {
@@ -383,6 +393,49 @@ public:
         return ret;
     }
     
+    // Calls f(i) in increasing order for each i < count such that sets[i]
+    // and x are disjoint. Single-word sets are tested eight or four at a time
+    // with AVX-512 or AVX2 compares that produce a bitmap of the matches.
+    template <typename F>
+    static void forEachDisjoint(const BitSet* sets, size_t count, const BitSet& x, F f) {
+        size_t i = 0;
+#if defined(__AVX512F__) || defined(__AVX2__)
+        if constexpr(W == 1) {
+            static_assert(sizeof(BitSet) == 8, "Single-word sets must be stored as words");
+            const uint64_t* words = (const uint64_t*)sets;
+#if defined(__AVX512F__)
+            __m512i xv = _mm512_set1_epi64(x.words_[0]);
+            // The last batch is loaded with a mask, so no scalar tail is left
+            for(; i < count; i += 8) {
+                __mmask8 load = count - i >= 8 ? 0xFF : (__mmask8)((1u << (count - i)) - 1);
+                __m512i v = _mm512_maskz_loadu_epi64(load, (const void*)(words + i));
+                uint32_t bits = _mm512_mask_testn_epi64_mask(load, v, xv);
+                while(bits) {
+                    f(i + __builtin_ctz(bits));
+                    bits &= bits - 1;
+                }
+            }
+#elif defined(__AVX2__)
+            __m256i xv = _mm256_set1_epi64x(x.words_[0]);
+            for(; i + 4 <= count; i += 4) {
+                __m256i v = _mm256_loadu_si256((const __m256i*)(words + i));
+                __m256i zero = _mm256_cmpeq_epi64(_mm256_and_si256(v, xv), _mm256_setzero_si256());
+                uint32_t bits = _mm256_movemask_pd(_mm256_castsi256_pd(zero));
+                while(bits) {
+                    f(i + __builtin_ctz(bits));
+                    bits &= bits - 1;
+                }
+            }
+#endif
+        }
+#endif
+        for(; i < count; ++i) {
+            if(setIntersection(sets[i], x).isEmpty()) {
+                f(i);
+            }
+        }
+    }
+    
     void print(ostream& out) const {
         out << "BitSet<" << W << ">(";
         bool first = true;
@@ -479,6 +532,18 @@ bool isSubset(const BitSet<W>& a, const BitSet<W>& b) {
     return true;
 }
 
+// Transposes the 64x64 bit matrix where element (i, j) is bit j of a[i]
+inline void transposeBitMatrix64(uint64_t* a) {
+    uint64_t m = UINT64_C(0x00000000FFFFFFFF);
+    for(int j = 32; j != 0; j >>= 1, m ^= m << j) {
+        for(int k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+            uint64_t t = ((a[k] >> j) ^ a[k | j]) & m;
+            a[k] ^= t << j;
+            a[k | j] ^= t;
+        }
+    }
+}
+
 namespace std {
 
 template <int W>
@@ -0,0 +1,171 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+
+#include <unistd.h>
+
+// Thrown out of a counting method when the active CancellationToken stops it.
+// The method leaves no state behind, so the next graph can be counted as
+// usual.
+class CountMAOCancelled : public exception {
+public:
+    enum Reason {
+        Cancelled,
+        TimeLimit,
+        MemoryLimit
+    };
+    
+    explicit CountMAOCancelled(Reason reason) : reason_(reason) { }
+    
+    Reason reason() const {
+        return reason_;
+    }
+    
+    const char* what() const noexcept override {
+        switch(reason_) {
+            case TimeLimit: return "time limit exceeded";
+            case MemoryLimit: return "memory limit exceeded";
+            default: return "cancelled";
+        }
+    }
+    
+private:
+    Reason reason_;
+};
+
+struct CountMAOProgress {
+    double seconds = 0.0;
+    uint64_t steps = 0;
+    uint64_t residentBytes = 0;
+};
+
+// Resident set size of the process in bytes, or 0 if it cannot be determined.
+inline uint64_t residentBytes() {
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if(fp == nullptr) {
+        return 0;
+    }
+    unsigned long long size, resident;
+    int got = fscanf(fp, "%llu %llu", &size, &resident);
+    fclose(fp);
+    return got == 2 ? (uint64_t)resident * sysconf(_SC_PAGESIZE) : 0;
+}
+
+// Limits and progress reporting for the counting methods in the current thread
+// while the token is installed as activeCancellationToken. The methods call
+// pollCancellation() in their inner loops; only every PollInterval:th poll
+// reads the clock, and the memory use and the progress callback are checked
+// at most every ResourceCheckSeconds, so polling is cheap.
+class CancellationToken {
+public:
+    static const uint64_t PollInterval = 4096;
+    static constexpr double ResourceCheckSeconds = 0.05;
+    
+    CancellationToken()
+        : startTime_(chrono::steady_clock::now()),
+          timeLimit_(HUGE_VAL),
+          memoryLimit_(UINT64_MAX),
+          progressInterval_(HUGE_VAL),
+          nextProgress_(HUGE_VAL),
+          nextResourceCheck_(0.0),
+          steps_(0),
+          cancelRequested_(false)
+    { }
+    
+    CancellationToken(const CancellationToken&) = delete;
+    CancellationToken& operator=(const CancellationToken&) = delete;
+    
+    // Time limit in seconds since the construction of the token.
+    void setTimeLimit(double seconds) {
+        timeLimit_ = seconds;
+    }
+    
+    // Limit for the resident set size of the whole process.
+    void setMemoryLimit(uint64_t bytes) {
+        memoryLimit_ = bytes;
+    }
+    
+    // Calls f approximately every intervalSeconds while counting.
+    void setProgressCallback(double intervalSeconds, function<void(const CountMAOProgress&)> f) {
+        progressInterval_ = intervalSeconds;
+        nextProgress_ = seconds() + intervalSeconds;
+        progressCallback_ = move(f);
+    }
+    
+    // Makes the next check throw. Safe to call from other threads and signal
+    // handlers.
+    void cancel() {
+        cancelRequested_.store(true, memory_order_relaxed);
+    }
+    
+    double seconds() const {
+        return chrono::duration<double>(chrono::steady_clock::now() - startTime_).count();
+    }
+    
+    uint64_t steps() const {
+        return steps_;
+    }
+    
+    void poll() {
+        if((steps_++ & (PollInterval - 1)) == 0) {
+            check();
+        }
+    }
+    
+    // Checks the limits and the cancellation request immediately.
+    void check() {
+        if(cancelRequested_.load(memory_order_relaxed)) {
+            throw CountMAOCancelled(CountMAOCancelled::Cancelled);
+        }
+        double now = seconds();
+        if(now >= timeLimit_) {
+            throw CountMAOCancelled(CountMAOCancelled::TimeLimit);
+        }
+        if(now < nextResourceCheck_) {
+            return;
+        }
+        nextResourceCheck_ = now + ResourceCheckSeconds;
+        
+        uint64_t resident = 0;
+        if(memoryLimit_ != UINT64_MAX || now >= nextProgress_) {
+            resident = residentBytes();
+        }
+        if(resident > memoryLimit_) {
+            throw CountMAOCancelled(CountMAOCancelled::MemoryLimit);
+        }
+        if(now >= nextProgress_) {
+            nextProgress_ = now + progressInterval_;
+            CountMAOProgress progress;
+            progress.seconds = now;
+            progress.steps = steps_;
+            progress.residentBytes = resident;
+            progressCallback_(progress);
+        }
+    }
+    
+private:
+    chrono::steady_clock::time_point startTime_;
+    double timeLimit_;
+    uint64_t memoryLimit_;
+    double progressInterval_;
+    double nextProgress_;
+    double nextResourceCheck_;
+    uint64_t steps_;
+    atomic<bool> cancelRequested_;
+    function<void(const CountMAOProgress&)> progressCallback_;
+};
+
+inline thread_local CancellationToken* activeCancellationToken = nullptr;
+
+// Throws CountMAOCancelled if the active token has been cancelled or one of its
+// limits has been exceeded.
+inline void pollCancellation() {
+    if(activeCancellationToken) {
+        activeCancellationToken->poll();
+    }
+}
@@ -1,10 +1,12 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <random>
 #include <set>
 #include <sstream>
@@ -21,7 +23,13 @@
 
 using namespace std;
 
-static thread_local mt19937 rng(random_device{}());
+inline thread_local mt19937 rng(random_device{}());
+
+// Makes the random numbers generated in the current thread reproducible.
+inline void seedRng(uint64_t seed) {
+    seed_seq seq = {(uint32_t)seed, (uint32_t)(seed >> 32)};
+    rng.seed(seq);
+}
 
 template <typename T>
 using UnifInt = uniform_int_distribution<T>;
@@ -32,6 +40,86 @@ using UnifReal = uniform_real_distribution<T>;
 typedef mpz_class Z;
 typedef mpq_class Q;
 
+// x += a * b in place, without allocating a temporary for the product. When
+// x is zero, its limbs are first grown to fit the product and one carry limb,
+// so that the following additions to the same x rarely reallocate.
+inline void addProduct(Z& x, const Z& a, const Z& b) {
+    mpz_ptr xp = x.get_mpz_t();
+    if(mpz_sgn(xp) == 0) {
+        int limbs = mpz_size(a.get_mpz_t()) + mpz_size(b.get_mpz_t()) + 1;
+        if(xp->_mp_alloc < limbs) {
+            mpz_realloc2(xp, (mp_bitcnt_t)limbs * GMP_NUMB_BITS);
+        }
+    }
+    mpz_addmul(xp, a.get_mpz_t(), b.get_mpz_t());
+}
+
+// Subset convolution of functions of the subsets of k elements, indexed by
+// bitmasks: ret[S] is the sum of f[A] g[B] over the disjoint A and B whose
+// union is S. The ranked zeta transforms of f and g are multiplied pointwise
+// and transformed back by the Möbius transform, which takes O(2^k k^2)
+// operations instead of the O(4^k) of going through the pairs.
+inline vector<Z> subsetConvolution(const vector<Z>& f, const vector<Z>& g, int k) {
+    size_t n = (size_t)1 << k;
+    assert(f.size() == n && g.size() == n);
+    
+    // fz[r][S] and gz[r][S] are the sums over the subsets of S of size r
+    vector<vector<Z>> fz(k + 1, vector<Z>(n));
+    vector<vector<Z>> gz(k + 1, vector<Z>(n));
+    for(size_t s = 0; s < n; ++s) {
+        int r = __builtin_popcountll(s);
+        fz[r][s] = f[s];
+        gz[r][s] = g[s];
+    }
+    for(int r = 0; r <= k; ++r) {
+        for(int i = 0; i < k; ++i) {
+            size_t bit = (size_t)1 << i;
+            for(size_t s = 0; s < n; ++s) {
+                if(s & bit) {
+                    fz[r][s] += fz[r][s ^ bit];
+                    gz[r][s] += gz[r][s ^ bit];
+                }
+            }
+        }
+    }
+    
+    // The sums over the subsets of size r of the products of the disjoint
+    // pairs; the pairs that overlap cancel out in the Möbius transform
+    vector<Z> h(n);
+    vector<Z> ret(n);
+    for(int r = 0; r <= k; ++r) {
+        for(size_t s = 0; s < n; ++s) {
+            h[s] = 0;
+            for(int i = 0; i <= r; ++i) {
+                addProduct(h[s], fz[i][s], gz[r - i][s]);
+            }
+        }
+        for(int i = 0; i < k; ++i) {
+            size_t bit = (size_t)1 << i;
+            for(size_t s = 0; s < n; ++s) {
+                if(s & bit) {
+                    h[s] -= h[s ^ bit];
+                }
+            }
+        }
+        for(size_t s = 0; s < n; ++s) {
+            if(__builtin_popcountll(s) == r) {
+                ret[s] = move(h[s]);
+            }
+        }
+    }
+    return ret;
+}
+
+template <typename T>
+ostream& operator<<(ostream& out, const vector<T>& vec);
+template <typename T, typename... R>
+ostream& operator<<(ostream& out, const set<T, R...>& s);
+template <typename A, typename B, typename... R>
+ostream& operator<<(ostream& out, const map<A, B, R...>& m);
+template <typename A, typename B>
+ostream& operator<<(ostream& out, const pair<A, B>& p);
+
 inline void stderrPrint() {
     cerr << "\n";
 }
@@ -195,47 +283,122 @@ ostream& operator<<(ostream& out, const T& obj) {
     return out;
 }
 
-class FactorialTable_ {
+// Exact factorials and binomial coefficients, computed on first use and shared
+// by all threads. Computed entries are never moved, so the
+// returned references stay valid, and reading an entry that already exists
+// only takes an atomic load; computing new entries takes a lock.
+class Combinatorics_ {
 private:
-    static vector<Z>& getTable_() {
-        static vector<Z> table;
-        return table;
-    }
+    static const int ChunkBits = 10;
+    static const int ChunkSize = 1 << ChunkBits;
+    static const int MaxChunks = 64;
     
-    template <int N>
-    friend class FactorialTable;
-};
-
-template <int N>
-class FactorialTable {
 public:
-    static const Z& get(int x) {
-        assert(x >= 0 && x <= N);
-        assert(x < (int)table_.size());
-        return table_[x];
+    static const int MaxN = ChunkSize * MaxChunks;
+    
+    static const Z& factorial(int n) {
+        assert(n >= 0);
+        if(n >= MaxN) {
+            fail("Combinatorics_: n = ", n, " exceeds the maximum ", MaxN - 1);
+        }
+        State_& s = state_();
+        if(n >= s.factorialCount.load(memory_order_acquire)) {
+            lock_guard<mutex> lock(s.mtx);
+            int count = s.factorialCount.load(memory_order_relaxed);
+            for(; count <= n; ++count) {
+                Z*& chunk = s.factorialChunks[count >> ChunkBits];
+                if(chunk == nullptr) {
+                    chunk = new Z[ChunkSize];
+                }
+                chunk[count & (ChunkSize - 1)] = count == 0 ? Z(1) : factorialEntry_(s, count - 1) * count;
+            }
+            s.factorialCount.store(count, memory_order_release);
+        }
+        return factorialEntry_(s, n);
+    }
+    
+    // The binomial coefficients C(n, 0), ..., C(n, n).
+    static const vector<Z>& binomialRow(int n) {
+        assert(n >= 0);
+        if(n >= MaxN) {
+            fail("Combinatorics_: n = ", n, " exceeds the maximum ", MaxN - 1);
+        }
+        State_& s = state_();
+        const vector<Z>* row = s.binomialRows[n].load(memory_order_acquire);
+        if(row == nullptr) {
+            lock_guard<mutex> lock(s.mtx);
+            row = s.binomialRows[n].load(memory_order_relaxed);
+            if(row == nullptr) {
+                vector<Z>* newRow = new vector<Z>(n + 1);
+                (*newRow)[0] = 1;
+                for(int k = 1; 2 * k <= n; ++k) {
+                    Z& x = (*newRow)[k];
+                    x = (*newRow)[k - 1] * (n - k + 1);
+                    mpz_divexact_ui(x.get_mpz_t(), x.get_mpz_t(), k);
+                }
+                for(int k = n / 2 + 1; k <= n; ++k) {
+                    (*newRow)[k] = (*newRow)[n - k];
+                }
+                row = newRow;
+                s.binomialRows[n].store(row, memory_order_release);
+            }
+        }
+        return *row;
     }
     
 private:
-    static vector<Z>& initializeTable_() {
-        vector<Z>& table = FactorialTable_::getTable_();
-        while((int)table.size() < N + 1) {
-            int i = table.size();
-            Z val;
-            if(i == 0) {
-                val = 1;
-            } else {
-                val = table.back() * i;
+    struct State_ {
+        mutex mtx;
+        atomic<int> factorialCount;
+        Z* factorialChunks[MaxChunks];
+        atomic<const vector<Z>*> binomialRows[MaxN];
+        
+        State_() : factorialCount(0), factorialChunks() {
+            for(atomic<const vector<Z>*>& row : binomialRows) {
+                row.store(nullptr, memory_order_relaxed);
             }
-            table.push_back(val);
         }
-        return table;
+    };
+    
+    static State_& state_() {
+        // Never destroyed, so that the tables can be used during static
+        // destruction
+        static State_* state = new State_();
+        return *state;
     }
     
-    static vector<Z>& table_;
+    static const Z& factorialEntry_(const State_& s, int n) {
+        return s.factorialChunks[n >> ChunkBits][n & (ChunkSize - 1)];
+    }
 };
 
-template <int N>
-vector<Z>& FactorialTable<N>::table_ = FactorialTable<N>::initializeTable_();
+inline const Z& factorial(int n) {
+    return Combinatorics_::factorial(n);
+}
+
+// The binomial coefficients C(n, 0), ..., C(n, n).
+inline const vector<Z>& binomialRow(int n) {
+    return Combinatorics_::binomialRow(n);
+}
+
+inline const Z& binomial(int n, int k) {
+    static const Z zero = 0;
+    if(k < 0 || k > n) {
+        return zero;
+    }
+    return Combinatorics_::binomialRow(n)[k];
+}
+
+// n (n - 1) ... (n - k + 1), multiplied out from n down, which only takes k
+// word multiplications and does not extend the factorial table
+inline Z fallingFactorial(int n, int k) {
+    assert(k >= 0 && k <= n);
+    Z ret = 1;
+    for(int i = n; i > n - k; --i) {
+        mpz_mul_ui(ret.get_mpz_t(), ret.get_mpz_t(), i);
+    }
+    return ret;
+}
 
 template<typename... T> struct LambdaVisitor : T... { using T::operator()...; };
 template<typename... T> LambdaVisitor(T...) -> LambdaVisitor<T...>;
@@ -277,62 +440,6 @@ SPECIALIZE_FAST_MEMORY_COMPARISONS(uint16_t)
 SPECIALIZE_FAST_MEMORY_COMPARISONS(uint32_t)
 SPECIALIZE_FAST_MEMORY_COMPARISONS(uint64_t)
 
-struct PoolAllocatorState {
-    PoolAllocatorState() : poolLeft(0), poolSize(0) { }
-    
-    unique_ptr<char[]> pool;
-    char* poolPos;
-    size_t poolLeft;
-    size_t poolSize;
-    vector<unique_ptr<char[]>> oldPools;
-};
-
-template <typename T>
-class PoolAllocator {
-public:
-    typedef T value_type;
-    
-    constexpr PoolAllocator() : state_(make_shared<PoolAllocatorState>()) { }
-    
-    template <class X>
-    constexpr PoolAllocator(const PoolAllocator<X>& x) noexcept : state_(x.state_) { }
-    
-    T* allocate(size_t n) {
-        n *= sizeof(T);
-        PoolAllocatorState& state = *state_;
-        if(state.poolLeft < n) {
-            state.oldPools.push_back(move(state.pool));
-            
-            state.poolSize = max(n, 2 * state.poolSize);
-            state.poolLeft = state.poolSize;
-            
-            state.pool = make_unique<char[]>(state.poolSize);
-            state.poolPos = state.pool.get();
-        }
-        T* ret = (T*)state.poolPos;
-        state.poolPos += n;
-        state.poolLeft -= n;
-        return ret;
-    }
-    void deallocate(T*, size_t) noexcept { }
-    
-    template <typename X>
-    bool operator==(const PoolAllocator<X>& x) {
-        return state_.get() == x.state_.get();
-    }
-    
-    template <typename X>
-    bool operator!=(const PoolAllocator<X>& x) {
-        return state_.get() != x.state_.get();
-    }
-    
-private:
-    shared_ptr<PoolAllocatorState> state_;
-    
-    template <typename X>
-    friend class PoolAllocator;
-};
-
 inline void removeStackLimit() {
     rlimit rl;
     if(getrlimit(RLIMIT_STACK, &rl)) fail("Getting stack limit failed");
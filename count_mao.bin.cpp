@@ -1,39 +1,238 @@
-#include "graph.hpp"
+#include "graph_io.hpp"
 #include "mao.hpp"
 
+#include <csignal>
+#include <fstream>
+
 using namespace std;
 
+namespace {
+
+// Exit codes for runs stopped before counting all the graphs
+const int TimeLimitExitCode = 3;
+const int MemoryLimitExitCode = 4;
+const int CancelledExitCode = 5;
+
+CancellationToken* signalCancellationToken = nullptr;
+
+// The first SIGINT or SIGTERM stops the run cleanly, and the next one kills
+// the process as usual.
+void handleCancelSignal(int sig) {
+    signal(sig, SIG_DFL);
+    if(signalCancellationToken) {
+        signalCancellationToken->cancel();
+    }
+}
+
+// Parses a byte count with an optional K, M or G suffix (powers of 1024).
+uint64_t parseByteCount(string str) {
+    uint64_t mul = 1;
+    if(!str.empty()) {
+        char suffix = toupper(str.back());
+        if(suffix == 'K' || suffix == 'M' || suffix == 'G') {
+            mul = uint64_t(1) << (suffix == 'K' ? 10 : suffix == 'M' ? 20 : 30);
+            str.pop_back();
+        }
+    }
+    if(str.empty() || str.find_first_not_of("0123456789") != string::npos) {
+        fail("Invalid byte count");
+    }
+    uint64_t value = 0;
+    for(char c : str) {
+        uint64_t digit = c - '0';
+        if(value > (UINT64_MAX - digit) / 10) {
+            fail("Invalid byte count");
+        }
+        value = 10 * value + digit;
+    }
+    if(value > UINT64_MAX / mul) {
+        fail("Invalid byte count");
+    }
+    return value * mul;
+}
+
+const pair<string, Z (*)(const GraphData&)>& findMethod(const string& namePrefix) {
+    const pair<string, Z (*)(const GraphData&)>* ret = nullptr;
+    for(const auto& p : countMAOMethods) {
+        if(p.first.substr(0, namePrefix.size()) == namePrefix) {
+            if(ret != nullptr) {
+                fail("Ambiguous method name");
+            }
+            ret = &p;
+        }
+    }
+    if(ret == nullptr) {
+        fail("Method not found");
+    }
+    return *ret;
+}
+
+int64_t peakResidentBytes() {
+    rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage)) {
+        fail("Getting resource usage failed");
+    }
+    return (int64_t)usage.ru_maxrss * 1024;
+}
+
+}
+
 int main(int argc, char* argv[]) {
     cin.sync_with_stdio(false);
     cin.tie(nullptr);
     
     removeStackLimit();
     
-    if(argc != 2) {
-        cerr << "Usage: <method name prefix>\n";
+    string tracePath;
+    string dotPath;
+    double timeLimit = HUGE_VAL;
+    uint64_t memoryLimit = UINT64_MAX;
+    double progressInterval = HUGE_VAL;
+    vector<string> portfolio;
+    string checkpointDir;
+    double checkpointMinSeconds = 1.0;
+    vector<string> args;
+    for(int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if(arg == "--timeout" && i + 1 < argc) {
+            timeLimit = fromString<double>(argv[++i]);
+        } else if(arg == "--max-memory" && i + 1 < argc) {
+            memoryLimit = parseByteCount(argv[++i]);
+        } else if(arg == "--progress" && i + 1 < argc) {
+            progressInterval = fromString<double>(argv[++i]);
+        } else if(arg == "--portfolio-method" && i + 1 < argc) {
+            portfolio.push_back(findMethod(argv[++i]).first);
+        } else if(arg == "--checkpoint-dir" && i + 1 < argc) {
+            checkpointDir = argv[++i];
+        } else if(arg == "--checkpoint-min-seconds" && i + 1 < argc) {
+            checkpointMinSeconds = fromString<double>(argv[++i]);
+        } else if(arg == "--profile-trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if(arg == "--profile-dot" && i + 1 < argc) {
+            dotPath = argv[++i];
+        } else {
+            args.push_back(arg);
+        }
+    }
+    
+    if(args.size() != 1) {
+        cerr << "Usage: [--timeout <seconds>] [--max-memory <bytes>[K|M|G]] [--progress <seconds>]\n";
+        cerr << "       [--portfolio-method <method name prefix>]...\n";
+        cerr << "       [--checkpoint-dir <dir>] [--checkpoint-min-seconds <seconds>]\n";
+        cerr << "       [--profile-trace <file>] [--profile-dot <file>] <method name prefix>\n";
+        cerr << "Exits with code " << TimeLimitExitCode << " if the time limit is exceeded, ";
+        cerr << MemoryLimitExitCode << " if the memory limit is exceeded\n";
+        cerr << "and " << CancelledExitCode << " if interrupted by SIGINT or SIGTERM.\n";
         cerr << "Available methods:\n";
         for(auto p : countMAOMethods) {
             cerr << "  \"" << p.first << "\"\n";
         }
         fail("Invalid command line");
     }
-    string namePrefix = argv[1];
+    Z (*method)(const GraphData&) = findMethod(args[0]).second;
     
-    Z (*method)(const GraphData&) = nullptr;
-    for(auto p : countMAOMethods) {
-        if(p.first.substr(0, namePrefix.size()) == namePrefix) {
-            if(method != nullptr) {
-                fail("Ambiguous method name");
-            }
-            method = p.second;
+    // The raced methods run in their own threads, which do not see the
+    // checkpoint or the profiler of this thread
+    if(method == countMAOUsingPortfolio && !(checkpointDir.empty() && tracePath.empty() && dotPath.empty())) {
+        fail("Checkpoints and merge profiles are not supported with the Portfolio method");
+    }
+    if(!portfolio.empty()) {
+        portfolioMethods = portfolio;
+    }
+    
+    // Profile the merge trees of the tree decomposition DP methods if requested
+    MergeProfiler profiler;
+    if(!tracePath.empty() || !dotPath.empty()) {
+        activeMergeProfiler = &profiler;
+    }
+    
+    // Save and resume the tree decomposition DPs if requested
+    unique_ptr<DPCheckpoint> checkpoint;
+    if(!checkpointDir.empty()) {
+        checkpoint = make_unique<DPCheckpoint>(checkpointDir, checkpointMinSeconds);
+        activeDPCheckpoint = checkpoint.get();
+    }
+    
+    int graphsCounted = 0;
+    CancellationToken token;
+    token.setTimeLimit(timeLimit);
+    token.setMemoryLimit(memoryLimit);
+    if(progressInterval != HUGE_VAL) {
+        token.setProgressCallback(progressInterval, [&](const CountMAOProgress& progress) {
+            cerr << "Progress: " << progress.seconds << " s, ";
+            cerr << graphsCounted << " graphs counted, ";
+            cerr << progress.steps << " steps, ";
+            cerr << progress.residentBytes << " bytes resident, ";
+            cerr << arenaStats.bytesInUse << " bytes in arenas, ";
+            cerr << countMAOStats.tableCount << " tables\n";
+        });
+    }
+    activeCancellationToken = &token;
+    signalCancellationToken = &token;
+    signal(SIGINT, handleCancelSignal);
+    signal(SIGTERM, handleCancelSignal);
+    
+    int exitCode = 0;
+    const char* stopReason = nullptr;
+    try {
+        readInputGraphs(STDIN_FILENO, [&](const GraphData& graphData) {
+            cout << method(graphData) << endl;
+            ++graphsCounted;
+        });
+    } catch(const CountMAOCancelled& e) {
+        stopReason = e.what();
+        if(e.reason() == CountMAOCancelled::TimeLimit) {
+            exitCode = TimeLimitExitCode;
+        } else if(e.reason() == CountMAOCancelled::MemoryLimit) {
+            exitCode = MemoryLimitExitCode;
+        } else {
+            exitCode = CancelledExitCode;
         }
+    } catch(const bad_alloc&) {
+        stopReason = "out of memory";
+        exitCode = MemoryLimitExitCode;
     }
-    if(method == nullptr) {
-        fail("Method not found");
+    
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signalCancellationToken = nullptr;
+    activeCancellationToken = nullptr;
+    activeDPCheckpoint = nullptr;
+    
+    if(checkpoint) {
+        cerr << "Checkpoints: " << checkpoint->loadedCount() << " loaded, ";
+        cerr << checkpoint->savedCount() << " saved\n";
     }
     
-    GraphData graphData = GraphData::read(cin);
-    cout << method(graphData) << "\n";
+    if(stopReason != nullptr) {
+        // The counts of the completed graphs have already been written, so
+        // only report the work done so far
+        cerr << "Stopped: " << stopReason << "\n";
+        cerr << "  graphs counted: " << graphsCounted << "\n";
+        cerr << "  seconds: " << token.seconds() << "\n";
+        cerr << "  steps: " << token.steps() << "\n";
+        cerr << "  peak resident bytes: " << peakResidentBytes() << "\n";
+        cerr << "  peak arena bytes: " << arenaStats.peakBytesInUse << "\n";
+        cerr << "  tables: " << countMAOStats.tableCount << "\n";
+        cerr << "  max table size: " << countMAOStats.maxTableSize << "\n";
+        cerr << "  total table size: " << countMAOStats.totalTableSize << "\n";
+    }
+    
+    activeMergeProfiler = nullptr;
+    if(!tracePath.empty()) {
+        ofstream out(tracePath);
+        profiler.writeChromeTrace(out);
+        if(!out) {
+            fail("Writing profile trace failed");
+        }
+    }
+    if(!dotPath.empty()) {
+        ofstream out(dotPath);
+        profiler.writeDot(out);
+        if(!out) {
+            fail("Writing profile DOT failed");
+        }
+    }
     
-    return 0;
+    return exitCode;
 }
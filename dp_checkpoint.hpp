@@ -0,0 +1,363 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Directory of checkpoints of the tree decomposition DP methods. While it is
+// installed as activeDPCheckpoint, the DP saves the output of every merge
+// subtree that takes at least minSeconds to evaluate, and a later run loads it
+// instead of evaluating the subtree again. The files are named by the method,
+// the hash of the input graph and the hash of the subtree, so the same
+// directory can be used for many inputs.
+class DPCheckpoint {
+public:
+    explicit DPCheckpoint(string dir, double minSeconds = 1.0)
+        : dir_(move(dir)),
+          minSeconds_(minSeconds),
+          loadedCount_(0),
+          savedCount_(0)
+    {
+        if(mkdir(dir_.c_str(), 0777) && errno != EEXIST) {
+            fail("Creating checkpoint directory '", dir_, "' failed");
+        }
+    }
+    
+    double minSeconds() const {
+        return minSeconds_;
+    }
+    
+    string path(const char* method, uint64_t graphHash, uint64_t subtreeHash) const {
+        char name[64];
+        snprintf(
+            name, sizeof(name), "%s-%016llx-%016llx.ckpt",
+            method, (unsigned long long)graphHash, (unsigned long long)subtreeHash
+        );
+        return dir_ + "/" + name;
+    }
+    
+    // Numbers of subtrees loaded from and saved to the directory.
+    uint64_t loadedCount() const {
+        return loadedCount_;
+    }
+    uint64_t savedCount() const {
+        return savedCount_;
+    }
+    void recordLoad() {
+        ++loadedCount_;
+    }
+    void recordSave() {
+        ++savedCount_;
+    }
+    
+private:
+    string dir_;
+    double minSeconds_;
+    uint64_t loadedCount_;
+    uint64_t savedCount_;
+};
+
+inline thread_local DPCheckpoint* activeDPCheckpoint = nullptr;
+
+// Checkpoint files consist of "MAOCKPT1", the data written by the user and
+// "MAOCKEND". The data is written to a temporary file that commit() syncs and
+// renames into place, so that an interrupted run never leaves a truncated
+// checkpoint behind.
+namespace dp_checkpoint {
+
+static const char HeaderMagic[8] = {'M', 'A', 'O', 'C', 'K', 'P', 'T', '1'};
+static const char TrailerMagic[8] = {'M', 'A', 'O', 'C', 'K', 'E', 'N', 'D'};
+static const size_t BufferSize = (size_t)1 << 16;
+
+}
+
+class CheckpointWriter {
+public:
+    explicit CheckpointWriter(string path)
+        : path_(move(path)),
+          tmpPath_(path_ + ".tmp")
+    {
+        fp_ = fopen(tmpPath_.c_str(), "wb");
+        if(fp_ == nullptr) {
+            fail("Opening checkpoint file '", tmpPath_, "' for writing failed");
+        }
+        setvbuf(fp_, nullptr, _IOFBF, dp_checkpoint::BufferSize);
+        write(dp_checkpoint::HeaderMagic, 8);
+    }
+    
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+    
+    ~CheckpointWriter() {
+        if(fp_ != nullptr) {
+            fclose(fp_);
+            unlink(tmpPath_.c_str());
+        }
+    }
+    
+    void write(const void* data, size_t size) {
+        if(fwrite(data, 1, size, fp_) != size) {
+            fail("Writing checkpoint file '", tmpPath_, "' failed");
+        }
+    }
+    void writeWord(uint64_t x) {
+        write(&x, 8);
+    }
+    void writeZ(const Z& x) {
+        if(!mpz_out_raw(fp_, x.get_mpz_t())) {
+            fail("Writing checkpoint file '", tmpPath_, "' failed");
+        }
+    }
+    
+    void commit() {
+        write(dp_checkpoint::TrailerMagic, 8);
+        if(fflush(fp_) || fsync(fileno(fp_)) || fclose(fp_)) {
+            fail("Writing checkpoint file '", tmpPath_, "' failed");
+        }
+        fp_ = nullptr;
+        if(rename(tmpPath_.c_str(), path_.c_str())) {
+            fail("Renaming checkpoint file '", tmpPath_, "' failed");
+        }
+    }
+    
+private:
+    string path_;
+    string tmpPath_;
+    FILE* fp_;
+};
+
+class CheckpointReader {
+public:
+    // If the file does not exist, isOpen() returns false.
+    explicit CheckpointReader(string path) : path_(move(path)) {
+        fp_ = fopen(path_.c_str(), "rb");
+        if(fp_ == nullptr) {
+            if(errno != ENOENT) {
+                fail("Opening checkpoint file '", path_, "' failed");
+            }
+            return;
+        }
+        setvbuf(fp_, nullptr, _IOFBF, dp_checkpoint::BufferSize);
+        char magic[8];
+        read(magic, 8);
+        if(memcmp(magic, dp_checkpoint::HeaderMagic, 8)) {
+            fail("Invalid checkpoint file '", path_, "'");
+        }
+    }
+    
+    CheckpointReader(const CheckpointReader&) = delete;
+    CheckpointReader& operator=(const CheckpointReader&) = delete;
+    
+    ~CheckpointReader() {
+        if(fp_ != nullptr) {
+            fclose(fp_);
+        }
+    }
+    
+    bool isOpen() const {
+        return fp_ != nullptr;
+    }
+    
+    void read(void* data, size_t size) {
+        if(fread(data, 1, size, fp_) != size) {
+            fail("Checkpoint file '", path_, "' is truncated");
+        }
+    }
+    uint64_t readWord() {
+        uint64_t x;
+        read(&x, 8);
+        return x;
+    }
+    Z readZ() {
+        Z x;
+        if(!mpz_inp_raw(x.get_mpz_t(), fp_)) {
+            fail("Checkpoint file '", path_, "' is truncated");
+        }
+        return x;
+    }
+    
+    // Checks that the whole file has been read.
+    void finish() {
+        char magic[8];
+        read(magic, 8);
+        if(memcmp(magic, dp_checkpoint::TrailerMagic, 8) || fgetc(fp_) != EOF) {
+            fail("Invalid checkpoint file '", path_, "'");
+        }
+    }
+    
+private:
+    string path_;
+    FILE* fp_;
+};
+
+// Writes the distribution of a tree decomposition DP over the orderings of
+// seqLen output vertices. The codec converts the keys of the distribution to
+// the sequences and the sets of lost predecessors that are written, so that
+// the file format does not depend on the representation of the keys. The
+// states are written in order, so that reading them back is linear in the
+// size of the distribution.
+template <typename Dist, typename Codec>
+void writeCheckpointDist(CheckpointWriter& out, const Dist& dist, const Codec& codec, int seqLen) {
+    int wordCount = (seqLen + 63) >> 6;
+    out.writeWord(seqLen);
+    out.writeWord(dist.size());
+    vector<uint16_t> seq(seqLen);
+    for(const auto& p : dist) {
+        auto keySeq = codec.seq(p.first);
+        for(int i = 0; i < seqLen; ++i) {
+            seq[i] = keySeq[i];
+        }
+        out.write(seq.data(), 2 * seqLen);
+        auto lostPred = codec.lostPred(p.first);
+        for(int w = 0; w < wordCount; ++w) {
+            out.writeWord(lostPred.word(w));
+        }
+        out.writeZ(p.second);
+    }
+}
+
+template <typename Dist, typename Codec>
+Dist readCheckpointDist(CheckpointReader& in, const Codec& codec, int seqLen) {
+    typedef typename Dist::key_type Key;
+    typedef typename decay<decltype(codec.seq(declval<Key>()))>::type Seq;
+    typedef typename decay<decltype(codec.lostPred(declval<Key>()))>::type LostPred;
+    
+    int wordCount = (seqLen + 63) >> 6;
+    if(in.readWord() != (uint64_t)seqLen || wordCount > LostPred::ParamW) {
+        fail("Checkpoint does not match the merge tree");
+    }
+    uint64_t size = in.readWord();
+    
+    Dist dist;
+    vector<uint16_t> seqElems(seqLen);
+    for(uint64_t i = 0; i < size; ++i) {
+        Seq seq;
+        in.read(seqElems.data(), 2 * seqLen);
+        for(int j = 0; j < seqLen; ++j) {
+            seq[j] = seqElems[j];
+        }
+        LostPred lostPred;
+        for(int w = 0; w < wordCount; ++w) {
+            lostPred.setWord(w, in.readWord());
+        }
+        dist.emplace_hint(dist.end(), codec.withLostPred(codec.first(seq), lostPred), in.readZ());
+    }
+    return dist;
+}
+
+namespace dp_checkpoint {
+
+// Codec for distributions keyed by pairs of a sequence and a set of lost
+// predecessors.
+template <typename State>
+struct PairCodec {
+    const typename State::first_type& seq(const State& state) const {
+        return state.first;
+    }
+    const typename State::second_type& lostPred(const State& state) const {
+        return state.second;
+    }
+    State first(const typename State::first_type& seq) const {
+        return {seq, typename State::second_type()};
+    }
+    State withLostPred(const State& first, const typename State::second_type& lostPred) const {
+        return {first.first, lostPred};
+    }
+};
+
+}
+
+template <typename Dist>
+void writeCheckpointDist(CheckpointWriter& out, const Dist& dist, int seqLen) {
+    writeCheckpointDist(out, dist, dp_checkpoint::PairCodec<typename Dist::key_type>(), seqLen);
+}
+
+template <typename Dist>
+Dist readCheckpointDist(CheckpointReader& in, int seqLen) {
+    return readCheckpointDist<Dist>(in, dp_checkpoint::PairCodec<typename Dist::key_type>(), seqLen);
+}
+
+// Checkpoint files of the subtrees of the merge tree of one chain component.
+// The output of the DP for a subtree depends only on the structure of the
+// subtree, which is covered by its hash. The hashes are indexed by the
+// addresses of the subtrees.
+class MergeTreeCheckpoints {
+public:
+    template <typename MergeTree>
+    MergeTreeCheckpoints(DPCheckpoint& dir, const char* method, uint64_t graphHash, const MergeTree& mergeTree)
+        : MergeTreeCheckpoints(dir, method, graphHash, mergeTree, [](uint64_t&, const auto&) { })
+    { }
+    
+    // hashNode(h, node) combines the method-specific fields of an inner node
+    // of the merge tree to the hash h.
+    template <typename MergeTree, typename F>
+    MergeTreeCheckpoints(
+        DPCheckpoint& dir,
+        const char* method,
+        uint64_t graphHash,
+        const MergeTree& mergeTree,
+        F hashNode
+    )
+        : dir_(dir),
+          method_(method),
+          graphHash_(graphHash)
+    {
+        hash_(mergeTree, hashNode);
+    }
+    
+    DPCheckpoint& dir() const {
+        return dir_;
+    }
+    
+    string path(const void* subtree) const {
+        return dir_.path(method_, graphHash_, hashes_.at(subtree));
+    }
+    
+    void remove(const void* subtree) const {
+        string p = path(subtree);
+        if(unlink(p.c_str()) && errno != ENOENT) {
+            fail("Removing checkpoint file '", p, "' failed");
+        }
+    }
+    
+private:
+    DPCheckpoint& dir_;
+    const char* method_;
+    uint64_t graphHash_;
+    unordered_map<const void*, uint64_t> hashes_;
+    
+    template <typename MergeTree, typename F>
+    uint64_t hash_(const MergeTree& mergeTree, F& hashNode) {
+        uint64_t ret = mergeTree.visit(
+            [&](const auto& node) {
+                uint64_t h = 1;
+                hashCombine(h, hash_(node.left, hashNode));
+                hashCombine(h, hash_(node.right, hashNode));
+                hashCombine(h, node.vertCount);
+                node.outputMask.iterate([&](int v) {
+                    hashCombine(h, v);
+                });
+                hashCombine(h, -1);
+                node.rightMask.iterate([&](int v) {
+                    hashCombine(h, v);
+                });
+                hashNode(h, node);
+                return h;
+            },
+            [&](const auto& leaf) {
+                uint64_t h = 2;
+                hashCombine(h, leaf.outputCount);
+                hashCombine(h, leaf.extraCount);
+                return h;
+            }
+        );
+        hashes_[&mergeTree] = ret;
+        return ret;
+    }
+};
@@ -34,6 +34,11 @@ public:
         : tree_(make_unique<variant<Node, Leaf>>(Leaf(move(leafData))))
     { }
     
+    bool isLeaf() const {
+        assert(tree_);
+        return holds_alternative<Leaf>(*tree_);
+    }
+    
     template <typename NodeVisitor, typename LeafVisitor>
     auto visit(NodeVisitor nodeVisitor, LeafVisitor leafVisitor) const {
         assert(tree_);
@@ -1,4 +1,4 @@
-#include "graph.hpp"
+#include "graph_io.hpp"
 
 using namespace std;
 
@@ -8,20 +8,58 @@ int main(int argc, char* argv[]) {
     
     removeStackLimit();
     
-    if(argc != 3) {
-        fail("Usage: <vertices> <edges>");
+    bool binary = false;
+    bool edgeList = false;
+    int count = 1;
+    vector<string> args;
+    for(int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if(arg == "--binary") {
+            binary = true;
+        } else if(arg == "--edge-list") {
+            edgeList = true;
+        } else if(arg == "--seed" && i + 1 < argc) {
+            seedRng(fromString<uint64_t>(argv[++i]));
+        } else if(arg == "--count" && i + 1 < argc) {
+            count = fromString<int>(argv[++i]);
+        } else {
+            args.push_back(arg);
+        }
     }
     
-    int n = fromString<int>(argv[1]);
-    int e = fromString<int>(argv[2]);
+    if(args.size() != 2) {
+        fail("Usage: [--binary | --edge-list] [--count <graphs>] [--seed <seed>] <vertices> <edges>");
+    }
+    
+    int n = fromString<int>(args[0]);
+    int e = fromString<int>(args[1]);
     
     if(n < 0 || e < 0) {
         fail("Number of vertices and edges must not be negative");
     }
+    if(binary && edgeList) {
+        fail("Only one of --binary and --edge-list may be given");
+    }
+    if(count < 1) {
+        fail("Number of graphs must be positive");
+    }
+    if(count != 1 && !binary) {
+        fail("Writing more than one graph requires --binary");
+    }
     
     selectGraphParam(n, [&](auto sel) {
         const int N = sel.Val;
-        Graph<N>::randomConnectedChordal(n, e).write(cout);
+        if(binary) {
+            GraphContainerWriter writer(cout);
+            for(int i = 0; i < count; ++i) {
+                writer.write(Graph<N>::randomConnectedChordal(n, e));
+            }
+            writer.finish();
+        } else if(edgeList) {
+            Graph<N>::randomConnectedChordal(n, e).writeEdgeList(cout);
+        } else {
+            Graph<N>::randomConnectedChordal(n, e).write(cout);
+        }
     });
     
     return 0;
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "bitset.hpp"
+#include "sparse_graph.hpp"
+#include "text_io.hpp"
 
 static const int DefaultMaxGraphSize = 4096;
 
@@ -20,11 +22,9 @@ public:
     }
     
     static Graph read(istream& in) {
-        auto exceptionMask = in.exceptions();
-        in.exceptions(in.failbit | in.badbit);
+        TextInput input(in);
         
-        int n;
-        in >> n;
+        int n = input.readInt();
         if(n < 0) {
             fail("Invalid input in Graph::read");
         }
@@ -33,20 +33,37 @@ public:
         }
         
         Graph graph(n);
+        uint64_t row[B::ParamW];
         for(int i = 0; i < n; ++i) {
-            for(int j = 0; j < n; ++j) {
-                int x;
-                in >> x;
-                if((x != 0 && x != 1) || (i == j && x)) {
-                    fail("Invalid input in readGraph");
-                }
-                if(x) {
-                    graph.addD(i, j);
-                }
+            input.readBitRow(row, n);
+            if((row[i >> 6] >> (i & 63)) & 1) {
+                fail("Invalid input in readGraph");
+            }
+            for(int w = 0; w < bitSetParam(n); ++w) {
+                graph.data_[i].second.setWord(w, row[w]);
+            }
+        }
+        graph.deriveEdgesIn_();
+        
+        return graph;
+    }
+    
+    // Constructs the graph from the outgoing edge sets of the vertices, given
+    // as consecutive rows of rowWords packed 64-bit words each.
+    static Graph fromPackedRows(int size, const uint64_t* rows, int rowWords) {
+        assert(size >= 0 && size <= N);
+        assert(rowWords >= bitSetParam(size) && bitSetParam(size) <= B::ParamW);
+        
+        Graph graph(size);
+        for(int v = 0; v < size; ++v) {
+            const uint64_t* row = rows + (size_t)v * rowWords;
+            for(int w = 0; w < bitSetParam(size); ++w) {
+                graph.data_[v].second.setWord(w, row[w]);
             }
+            assert(isSubset(graph.data_[v].second, graph.vertexSet().without(v)));
         }
+        graph.deriveEdgesIn_();
         
-        in.exceptions(exceptionMask);
         return graph;
     }
     
@@ -108,15 +125,18 @@ public:
                 int a = pool[i].first;
                 int b = pool[i].second;
                 
-                graph.addU(a, b);
-                if(graph.isChordal()) {
+                // The graph is connected, so a and b can only be separated by
+                // their common neighbors if there are any
+                if(
+                    setIntersection(graph.edgesOut(a), graph.edgesOut(b)).isNonEmpty() &&
+                    graph.isChordalAfterAddUInChordal(a, b)
+                ) {
+                    graph.addU(a, b);
                     found = true;
                     swap(pool[i], pool.back());
                     pool.pop_back();
                     ++edgesAdded;
                     break;
-                } else {
-                    graph.delU(a, b);
                 }
             }
             
@@ -128,6 +148,56 @@ public:
         return graph;
     }
     
+    // Random undirected k-tree: starting from a clique of min(k + 1,
+    // vertCount) vertices, each remaining vertex is connected to all vertices
+    // of a uniformly chosen k-clique of an existing (k + 1)-clique.
+    static Graph randomKTree(int vertCount, int k) {
+        if(vertCount < 0 || k < 1) {
+            fail("Invalid parameters for a random k-tree");
+        }
+        
+        vector<int> perm(vertCount);
+        for(int i = 0; i < vertCount; ++i) {
+            perm[i] = i;
+        }
+        shuffle(perm.begin(), perm.end(), rng);
+        
+        Graph graph(vertCount);
+        int initial = min(k + 1, vertCount);
+        for(int i = 0; i < initial; ++i) {
+            for(int j = i + 1; j < initial; ++j) {
+                graph.addU(perm[i], perm[j]);
+            }
+        }
+        
+        vector<B> cliques;
+        if(initial == k + 1) {
+            B clique;
+            for(int i = 0; i < initial; ++i) {
+                clique.add(perm[i]);
+            }
+            cliques.push_back(clique);
+        }
+        for(int i = initial; i < vertCount; ++i) {
+            B clique = cliques[UnifInt<int>(0, cliques.size() - 1)(rng)];
+            int skip = UnifInt<int>(0, k)(rng);
+            int removed = -1;
+            clique.iterate([&](int x) {
+                if(skip-- == 0) {
+                    removed = x;
+                }
+            });
+            clique.del(removed);
+            int v = perm[i];
+            clique.iterate([&](int x) {
+                graph.addU(v, x);
+            });
+            cliques.push_back(clique.with(v));
+        }
+        
+        return graph;
+    }
+    
     int size() const {
         return size_;
     }
@@ -331,28 +401,19 @@ public:
         assert(isSubset(verts, vertexSet()));
         assert(verts.has(v));
         
-        B comp(v);
-        B queue(v);
-        
-        while(!queue.isEmpty()) {
-            int x = queue.min();
-            queue.del(x);
-            
-            B add = setDifference(
-                setIntersection(bidirectionalNeighbors(x), verts),
-                comp
-            );
-            comp = setUnion(comp, add);
-            queue = setUnion(queue, add);
-        }
-        
-        return comp;
+        return frontierSearch_(verts, v, [&](int x) {
+            return bidirectionalNeighbors(x);
+        });
     }
     
     B bidirectionalComponent(int v) const {
         return bidirectionalComponent(vertexSet(), v);
     }
     
+    // The components are found by one frontier search each over the vertices
+    // not yet assigned. Labeling them in one union-find pass over the edges,
+    // or reading only the words of the rows that contain unvisited vertices,
+    // is slower: a full-width row union is only a few vector instructions.
     template <typename F>
     void iterateBidirectionalComponents(B verts, F f) const {
         while(verts.isNonEmpty()) {
@@ -372,22 +433,9 @@ public:
         assert(isSubset(verts, vertexSet()));
         assert(verts.has(v));
         
-        B comp(v);
-        B queue(v);
-        
-        while(!queue.isEmpty()) {
-            int x = queue.min();
-            queue.del(x);
-            
-            B add = setDifference(
-                setIntersection(neighbors(x), verts),
-                comp
-            );
-            comp = setUnion(comp, add);
-            queue = setUnion(queue, add);
-        }
-        
-        return comp;
+        return frontierSearch_(verts, v, [&](int x) {
+            return neighbors(x);
+        });
     }
     
     B component(int v) const {
@@ -413,22 +461,9 @@ public:
         assert(isSubset(verts, vertexSet()));
         assert(verts.has(v));
         
-        B comp(v);
-        B queue(v);
-        
-        while(!queue.isEmpty()) {
-            int x = queue.min();
-            queue.del(x);
-            
-            B add = setDifference(
-                setIntersection(edgesOut(x), verts),
-                comp
-            );
-            comp = setUnion(comp, add);
-            queue = setUnion(queue, add);
-        }
-        
-        return comp;
+        return frontierSearch_(verts, v, [&](int x) {
+            return edgesOut(x);
+        });
     }
     
     B reachableVertices(int v) const {
@@ -439,22 +474,9 @@ public:
         assert(isSubset(verts, vertexSet()));
         assert(verts.has(v));
         
-        B comp(v);
-        B queue(v);
-        
-        while(!queue.isEmpty()) {
-            int x = queue.min();
-            queue.del(x);
-            
-            B add = setDifference(
-                setIntersection(directedEdgesOut(x), verts),
-                comp
-            );
-            comp = setUnion(comp, add);
-            queue = setUnion(queue, add);
-        }
-        
-        return comp;
+        return frontierSearch_(verts, v, [&](int x) {
+            return directedEdgesOut(x);
+        });
     }
     
     B directedReachableVertices(int v) const {
@@ -466,30 +488,9 @@ public:
         assert(verts.has(a));
         assert(verts.has(b));
         
-        if(a == b) {
-            return true;
-        }
-        
-        B comp(a);
-        B queue(a);
-        
-        while(!queue.isEmpty()) {
-            int x = queue.min();
-            queue.del(x);
-            
-            B add = setDifference(
-                setIntersection(directedEdgesOut(x), verts),
-                comp
-            );
-            if(add.has(b)) {
-                return true;
-            }
-            
-            comp = setUnion(comp, add);
-            queue = setUnion(queue, add);
-        }
-        
-        return false;
+        return frontierSearch_(verts, a, [&](int x) {
+            return directedEdgesOut(x);
+        }, b).has(b);
     }
     
     bool isDirectedReachable(int a, int b) const {
@@ -518,16 +519,19 @@ public:
     }
     
     void write(ostream& out) const {
-        out << size() << '\n';
+        string buf = toString(size()) + '\n';
+        uint64_t row[B::ParamW];
         for(int i = 0; i < size(); ++i) {
-            for(int j = 0; j < size(); ++j) {
-                if(j) {
-                    out << ' ';
-                }
-                out << (int)(*this)(i, j);
+            for(int w = 0; w < B::ParamW; ++w) {
+                row[w] = data_[i].second.word(w);
+            }
+            appendBitRow(buf, row, size());
+            if(buf.size() >= ((size_t)1 << 20)) {
+                out.write(buf.data(), buf.size());
+                buf.clear();
             }
-            out << '\n';
         }
+        out.write(buf.data(), buf.size());
     }
     
     bool tryFindPerfectEliminationOrdering(int* output) const {
@@ -561,6 +565,45 @@ public:
         return order;
     }
     
+    // Assuming that the graph is undirected and chordal, checks whether it
+    // stays chordal when the undirected edge a - b is added. This is the case
+    // if and only if the common neighbors of a and b separate a from b.
+    bool isChordalAfterAddUInChordal(int a, int b) const {
+        assert(a >= 0 && a < size());
+        assert(b >= 0 && b < size());
+        assert(a != b);
+        assert(!(*this)(a, b) && !(*this)(b, a));
+        
+        B common = setIntersection(neighbors(a), neighbors(b));
+        B verts = setDifference(vertexSet(), common);
+        
+        // Grow the components of a and b in the graph without the common
+        // neighbors alternately one vertex at a time, so that the search stops
+        // as soon as they meet or the smaller one is exhausted.
+        B comp[2] = {B(a), B(b)};
+        B queue[2] = {B(a), B(b)};
+        
+        for(int side = 0; ; side ^= 1) {
+            if(queue[side].isEmpty()) {
+                return true;
+            }
+            
+            int x = queue[side].min();
+            queue[side].del(x);
+            
+            B add = setDifference(
+                setIntersection(neighbors(x), verts),
+                comp[side]
+            );
+            if(setIntersection(add, comp[side ^ 1]).isNonEmpty()) {
+                return false;
+            }
+            
+            comp[side] = setUnion(comp[side], add);
+            queue[side] = setUnion(queue[side], add);
+        }
+    }
+    
     template <typename F>
     void iterateMaximalCliquesInChordal(F f) const {
         findPerfectEliminationOrderingInChordal_([&](int, int v, const B& neigh, const B& done) {
@@ -583,24 +626,54 @@ public:
     }
     
     void toDot(ostream& out) const {
-        out << "digraph {\n";
+        string buf = "digraph {\n";
+        for(int i = 0; i < size(); ++i) {
+            buf += "  " + to_string(i) + "\n";
+        }
         for(int i = 0; i < size(); ++i) {
-            out << "  " << i << "\n";
+            setDifference(neighbors(i), B::range(i + 1)).iterate([&](int j) {
+                if((*this)(i, j)) {
+                    if((*this)(j, i)) {
+                        buf += "  " + to_string(i) + " -> " + to_string(j) + " [dir=none]\n";
+                    } else {
+                        buf += "  " + to_string(i) + " -> " + to_string(j) + "\n";
+                    }
+                } else {
+                    buf += "  " + to_string(j) + " -> " + to_string(i) + "\n";
+                }
+            });
+            if(buf.size() >= ((size_t)1 << 20)) {
+                out.write(buf.data(), buf.size());
+                buf.clear();
+            }
         }
+        buf += "}\n";
+        out.write(buf.data(), buf.size());
+    }
+    
+    // Writes the graph in the edge list format read by GraphData::read: the
+    // keyword "edges" and the number of vertices, followed by one line per
+    // edge, "a -- b" for undirected and "a -> b" for directed edges.
+    void writeEdgeList(ostream& out) const {
+        string buf = "edges " + to_string(size()) + "\n";
         for(int i = 0; i < size(); ++i) {
-            for(int j = i + 1; j < size(); ++j) {
+            setDifference(neighbors(i), B::range(i + 1)).iterate([&](int j) {
                 if((*this)(i, j)) {
                     if((*this)(j, i)) {
-                        out << "  " << i << " -> " << j << " [dir=none]\n";
+                        buf += to_string(i) + " -- " + to_string(j) + "\n";
                     } else {
-                        out << "  " << i << " -> " << j << "\n";
+                        buf += to_string(i) + " -> " + to_string(j) + "\n";
                     }
-                } else if((*this)(j, i)) {
-                    out << "  " << j << " -> " << i << "\n";
+                } else {
+                    buf += to_string(j) + " -> " + to_string(i) + "\n";
                 }
+            });
+            if(buf.size() >= ((size_t)1 << 20)) {
+                out.write(buf.data(), buf.size());
+                buf.clear();
             }
         }
-        out << "}\n";
+        out.write(buf.data(), buf.size());
     }
     
     void print(ostream& out) const {
@@ -697,6 +770,49 @@ private:
     int size_;
     pair<B, B> data_[N];
     
+    // Sets the incoming edge sets of all vertices from the outgoing ones by
+    // transposing the adjacency matrix in 64x64 blocks.
+    void deriveEdgesIn_() {
+        int blockCount = bitSetParam(size());
+        uint64_t block[64];
+        for(int bi = 0; bi < blockCount; ++bi) {
+            for(int bj = 0; bj < blockCount; ++bj) {
+                for(int r = 0; r < 64; ++r) {
+                    int v = 64 * bi + r;
+                    block[r] = v < size() ? data_[v].second.word(bj) : 0;
+                }
+                transposeBitMatrix64(block);
+                for(int c = 0; c < 64; ++c) {
+                    int v = 64 * bj + c;
+                    if(v < size()) {
+                        data_[v].first.setWord(bi, block[c]);
+                    }
+                }
+            }
+        }
+    }
+    
+    // Breadth-first search in verts starting from v, where the successors of
+    // x are given by edges(x). The whole frontier is expanded at once in each
+    // round. Returns the set of visited vertices; if target is given, the
+    // search stops as soon as it is visited.
+    template <typename E>
+    B frontierSearch_(B verts, int v, E edges, int target = -1) const {
+        B comp(v);
+        B frontier(v);
+        
+        while(frontier.isNonEmpty() && (target == -1 || !comp.has(target))) {
+            B next;
+            frontier.iterate([&](int x) {
+                next = setUnion(next, edges(x));
+            });
+            frontier = setDifference(setIntersection(next, verts), comp);
+            comp = setUnion(comp, frontier);
+        }
+        
+        return comp;
+    }
+    
     template <typename F>
     bool findEliminationOrdering_(F f) const {
         int P[N] = {};
@@ -760,72 +876,205 @@ void selectGraphParam(int n, F f) {
     select2Pow<ceilLog2(M)>(n, f);
 }
 
+// Graph stored as packed adjacency rows, without a fixed maximum size. The rows
+// are immutable and shared between copies; they may also live in memory owned
+// by someone else, such as a memory-mapped file. Sparse inputs are stored as a
+// SparseGraph instead, and the rows are only built when the graph is accessed
+// as a Graph<N>.
 class GraphData {
 public:
-    GraphData() : size_(0) { }
+    GraphData() : size_(0), rowWords_(0), rows_(nullptr) { }
+    
+    explicit GraphData(SparseGraph graph)
+        : size_(graph.size()),
+          rowWords_(bitSetParam(graph.size())),
+          rows_(nullptr),
+          sparse_(make_shared<const SparseGraph>(move(graph)))
+    { }
     
     template <int N>
     GraphData(const Graph<N>& graph)
-        : size_(graph.size())
+        : GraphData(graph.size(), packRows_(graph))
+    { }
+    
+    // Takes rows of bitSetParam(size) words each.
+    GraphData(int size, vector<uint64_t> rows)
+        : GraphData(size, make_shared<const vector<uint64_t>>(move(rows)))
+    { }
+    
+    // Refers to rows of bitSetParam(size) words each, kept alive by owner.
+    GraphData(int size, const uint64_t* rows, shared_ptr<const void> owner)
+        : size_(size),
+          rowWords_(bitSetParam(size)),
+          rows_(rows),
+          owner_(move(owner))
     {
-        data_.resize(size_ * size_);
-        int p = 0;
-        for(int i = 0; i < size_; ++i) {
-            for(int j = 0; j < size_; ++j) {
-                data_[p++] = graph(i, j);
-            }
-        }
+        assert(size >= 0);
     }
     
     static GraphData read(istream& in) {
-        auto exceptionMask = in.exceptions();
-        in.exceptions(in.failbit | in.badbit);
+        TextInput input(in);
+        return read(input);
+    }
+    
+    // Reads either an adjacency matrix or, if the input starts with the
+    // keyword "edges", an edge list in the format of Graph::writeEdgeList.
+    static GraphData read(TextInput& input) {
+        if(input.tryReadToken("edges")) {
+            return readEdgeList_(input);
+        }
         
-        int n;
-        in >> n;
+        int n = input.readInt();
         if(n < 0) {
             fail("Invalid input in GraphData::read");
         }
         
-        GraphData ret;
-        ret.size_ = n;
-        ret.data_.resize(n * n);
-        
-        int p = 0;
+        vector<uint64_t> rows((size_t)n * bitSetParam(n));
         for(int i = 0; i < n; ++i) {
-            for(int j = 0; j < n; ++j) {
-                int x;
-                in >> x;
-                if((x != 0 && x != 1) || (i == j && x)) {
-                    fail("Invalid input in readGraph");
-                }
-                ret.data_[p++] = (bool)x;
+            uint64_t* row = rows.data() + (size_t)i * bitSetParam(n);
+            input.readBitRow(row, n);
+            if((row[i >> 6] >> (i & 63)) & 1) {
+                fail("Invalid input in readGraph");
             }
         }
         
-        in.exceptions(exceptionMask);
+        return GraphData(n, move(rows));
+    }
+    
+    int size() const {
+        return size_;
+    }
+    
+    bool isSparse() const {
+        return (bool)sparse_;
+    }
+    
+    // Returns the graph in sparse form, converting it from the packed rows if
+    // necessary.
+    shared_ptr<const SparseGraph> sparseGraph() const {
+        if(sparse_) {
+            return sparse_;
+        }
+        vector<pair<int, int>> edges;
+        for(int v = 0; v < size_; ++v) {
+            const uint64_t* row = rows_ + (size_t)v * rowWords_;
+            for(int w = 0; w < rowWords_; ++w) {
+                uint64_t word = row[w];
+                while(word) {
+                    edges.emplace_back(v, 64 * w + __builtin_ctzll(word));
+                    word &= word - 1;
+                }
+            }
+        }
+        return make_shared<const SparseGraph>(size_, edges);
+    }
+    
+    // Hash of the size and the edges of the graph, independent of whether it
+    // is stored in sparse form.
+    uint64_t hash() const {
+        uint64_t edgeSum = 0;
+        auto addEdge = [&](int a, int b) {
+            uint64_t h = 0;
+            hashCombine(h, (uint64_t)a << 32 | (uint64_t)b);
+            edgeSum += h;
+        };
+        if(sparse_) {
+            for(int v = 0; v < size_; ++v) {
+                sparse_->iterateEdgesOut(v, [&](int x) {
+                    addEdge(v, x);
+                });
+            }
+        } else {
+            for(int v = 0; v < size_; ++v) {
+                const uint64_t* row = rows_ + (size_t)v * rowWords_;
+                for(int w = 0; w < rowWords_; ++w) {
+                    uint64_t word = row[w];
+                    while(word) {
+                        addEdge(v, 64 * w + __builtin_ctzll(word));
+                        word &= word - 1;
+                    }
+                }
+            }
+        }
+        uint64_t ret = 0;
+        hashCombine(ret, size_);
+        hashCombine(ret, edgeSum);
         return ret;
     }
     
     template <int M = DefaultMaxGraphSize, typename F>
     void accessGraph(F f) const {
         selectGraphParam<M>(size_, [&](auto sel) {
-            Graph<sel.Val> graph(size_);
-            int p = 0;
-            for(int i = 0; i < size_; ++i) {
-                for(int j = 0; j < size_; ++j) {
-                    if(data_[p++]) {
-                        graph.addD(i, j);
-                    }
+            if(sparse_) {
+                vector<uint64_t> rows((size_t)size_ * rowWords_);
+                for(int v = 0; v < size_; ++v) {
+                    sparse_->iterateEdgesOut(v, [&](int x) {
+                        rows[(size_t)v * rowWords_ + (x >> 6)] |= (uint64_t)1 << (x & 63);
+                    });
                 }
+                Graph<sel.Val> graph = Graph<sel.Val>::fromPackedRows(size_, rows.data(), rowWords_);
+                f(graph);
+            } else {
+                Graph<sel.Val> graph = Graph<sel.Val>::fromPackedRows(size_, rows_, rowWords_);
+                f(graph);
             }
-            f(graph);
         });
     }
     
 private:
     int size_;
-    vector<bool> data_;
+    int rowWords_;
+    const uint64_t* rows_;
+    shared_ptr<const void> owner_;
+    shared_ptr<const SparseGraph> sparse_;
+    
+    GraphData(int size, shared_ptr<const vector<uint64_t>> rows)
+        : GraphData(size, rows->data(), rows)
+    {
+        assert(rows->size() == (size_t)size * bitSetParam(size));
+    }
+    
+    static GraphData readEdgeList_(TextInput& input) {
+        int n = input.readInt();
+        if(n < 0) {
+            fail("Invalid input in GraphData::read");
+        }
+        
+        vector<pair<int, int>> edges;
+        while(!input.atEnd()) {
+            int a = input.readInt();
+            bool directed;
+            if(input.tryReadToken("->")) {
+                directed = true;
+            } else if(input.tryReadToken("--")) {
+                directed = false;
+            } else {
+                fail("Invalid input: expected -> or -- in edge list");
+            }
+            int b = input.readInt();
+            if(a < 0 || a >= n || b < 0 || b >= n || a == b) {
+                fail("Invalid input: invalid edge ", a, " ", b, " in edge list");
+            }
+            edges.emplace_back(a, b);
+            if(!directed) {
+                edges.emplace_back(b, a);
+            }
+        }
+        
+        return GraphData(SparseGraph(n, edges));
+    }
+    
+    template <int N>
+    static vector<uint64_t> packRows_(const Graph<N>& graph) {
+        int rowWords = bitSetParam(graph.size());
+        vector<uint64_t> rows((size_t)graph.size() * rowWords);
+        for(int v = 0; v < graph.size(); ++v) {
+            for(int w = 0; w < rowWords; ++w) {
+                rows[(size_t)v * rowWords + w] = graph.edgesOut(v).word(w);
+            }
+        }
+        return rows;
+    }
 };
 
 template <int M = DefaultMaxGraphSize, typename F>
@@ -0,0 +1,310 @@
+#pragma once
+
+#include "graph.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The whole contents of a file descriptor in memory. Regular files are
+// memory-mapped, and other inputs such as pipes are read into a buffer.
+class MappedInput {
+public:
+    explicit MappedInput(int fd) : map_(nullptr), mapSize_(0) {
+        struct stat st;
+        off_t pos = lseek(fd, 0, SEEK_CUR);
+        if(
+            fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+            pos >= 0 && pos % 8 == 0 && st.st_size > pos
+        ) {
+            void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(map != MAP_FAILED) {
+                map_ = map;
+                mapSize_ = st.st_size;
+                data_ = (const char*)map + pos;
+                size_ = st.st_size - pos;
+                return;
+            }
+        }
+        
+        // Read into a buffer of words so that the data is aligned like a mapping
+        size_t size = 0;
+        while(true) {
+            const size_t ChunkSize = (size_t)1 << 20;
+            buf_.resize((size + ChunkSize + 7) / 8);
+            ssize_t got = ::read(fd, (char*)buf_.data() + size, ChunkSize);
+            if(got < 0) {
+                fail("Reading input failed");
+            }
+            if(got == 0) {
+                break;
+            }
+            size += got;
+        }
+        data_ = (const char*)buf_.data();
+        size_ = size;
+    }
+    
+    MappedInput(const MappedInput&) = delete;
+    MappedInput& operator=(const MappedInput&) = delete;
+    
+    ~MappedInput() {
+        if(map_ != nullptr) {
+            munmap(map_, mapSize_);
+        }
+    }
+    
+    const char* data() const {
+        return data_;
+    }
+    size_t size() const {
+        return size_;
+    }
+    
+private:
+    void* map_;
+    size_t mapSize_;
+    vector<uint64_t> buf_;
+    const char* data_;
+    size_t size_;
+};
+
+// Binary container of many graphs. All fields are little-endian and every
+// record starts at a multiple of 8 bytes:
+//   header:  "MAOGRAPH", uint32 version, uint32 zero
+//   graphs:  uint32 size n, uint32 encoding, uint64 payload word count,
+//            payload words
+//   index:   uint64 byte offset of each graph record
+//   trailer: uint64 index offset, uint64 graph count, "MAOINDEX"
+// Graphs are encoded either densely as n rows of bitSetParam(n) words of
+// outgoing edges, or sparsely as one word (a | b << 32) per directed edge
+// a -> b. The index is at the end so that the container can be written in
+// one pass to a pipe.
+namespace graph_container {
+
+static const char HeaderMagic[8] = {'M', 'A', 'O', 'G', 'R', 'A', 'P', 'H'};
+static const char TrailerMagic[8] = {'M', 'A', 'O', 'I', 'N', 'D', 'E', 'X'};
+static const uint32_t Version = 1;
+static const size_t HeaderSize = 16;
+static const size_t TrailerSize = 24;
+static const size_t RecordHeaderSize = 16;
+
+enum Encoding : uint32_t {
+    Dense = 0,
+    Sparse = 1
+};
+
+}
+
+class GraphContainerWriter {
+public:
+    explicit GraphContainerWriter(ostream& out)
+        : out_(out),
+          pos_(0),
+          finished_(false)
+    {
+        uint32_t header[2] = {graph_container::Version, 0};
+        write_(graph_container::HeaderMagic, 8);
+        write_(header, 8);
+    }
+    
+    GraphContainerWriter(const GraphContainerWriter&) = delete;
+    GraphContainerWriter& operator=(const GraphContainerWriter&) = delete;
+    
+    ~GraphContainerWriter() {
+        assert(finished_);
+    }
+    
+    template <int N>
+    void write(const Graph<N>& graph) {
+        using namespace graph_container;
+        assert(!finished_);
+        
+        int n = graph.size();
+        int rowWords = bitSetParam(n);
+        uint64_t edgeCount = 0;
+        for(int v = 0; v < n; ++v) {
+            edgeCount += graph.edgesOut(v).count();
+        }
+        
+        bool sparse = edgeCount < (uint64_t)n * rowWords;
+        uint64_t payloadWords = sparse ? edgeCount : (uint64_t)n * rowWords;
+        
+        offsets_.push_back(pos_);
+        uint32_t recordHeader[2] = {(uint32_t)n, sparse ? Sparse : Dense};
+        write_(recordHeader, 8);
+        write_(&payloadWords, 8);
+        
+        vector<uint64_t> buf;
+        auto flush = [&]() {
+            write_(buf.data(), 8 * buf.size());
+            buf.clear();
+        };
+        for(int v = 0; v < n; ++v) {
+            if(sparse) {
+                graph.edgesOut(v).iterate([&](int x) {
+                    buf.push_back((uint64_t)v | ((uint64_t)x << 32));
+                });
+            } else {
+                for(int w = 0; w < rowWords; ++w) {
+                    buf.push_back(graph.edgesOut(v).word(w));
+                }
+            }
+            if(buf.size() >= ((size_t)1 << 17)) {
+                flush();
+            }
+        }
+        flush();
+    }
+    
+    void finish() {
+        assert(!finished_);
+        finished_ = true;
+        
+        uint64_t indexOffset = pos_;
+        write_(offsets_.data(), 8 * offsets_.size());
+        uint64_t trailer[2] = {indexOffset, (uint64_t)offsets_.size()};
+        write_(trailer, 16);
+        write_(graph_container::TrailerMagic, 8);
+        out_.flush();
+    }
+    
+private:
+    ostream& out_;
+    uint64_t pos_;
+    vector<uint64_t> offsets_;
+    bool finished_;
+    
+    void write_(const void* data, size_t size) {
+        out_.write((const char*)data, size);
+        if(!out_) {
+            fail("Writing graph container failed");
+        }
+        pos_ += size;
+    }
+};
+
+// Read-only view of a graph container in memory. Densely encoded graphs are
+// accessed in place without copying.
+class GraphContainer {
+public:
+    static bool isContainer(const char* data, size_t size) {
+        return size >= graph_container::HeaderSize && !memcmp(data, graph_container::HeaderMagic, 8);
+    }
+    
+    // The data must be 8-byte aligned and stay alive as long as owner does.
+    GraphContainer(const char* data, size_t size, shared_ptr<const void> owner)
+        : data_(data),
+          size_(size),
+          owner_(move(owner))
+    {
+        using namespace graph_container;
+        
+        if(((uintptr_t)data & 7) != 0) {
+            fail("Graph container data is not aligned");
+        }
+        if(!isContainer(data, size) || size < HeaderSize + TrailerSize || size % 8 != 0) {
+            fail("Invalid graph container");
+        }
+        uint32_t version;
+        memcpy(&version, data + 8, 4);
+        if(version != Version) {
+            fail("Unsupported graph container version ", version);
+        }
+        if(memcmp(data + size - 8, TrailerMagic, 8)) {
+            fail("Invalid graph container: missing index");
+        }
+        const uint64_t* trailer = (const uint64_t*)(data + size - TrailerSize);
+        uint64_t indexOffset = trailer[0];
+        count_ = trailer[1];
+        if(
+            indexOffset < HeaderSize || indexOffset % 8 != 0 ||
+            indexOffset > size - TrailerSize ||
+            (size - TrailerSize - indexOffset) / 8 != count_
+        ) {
+            fail("Invalid graph container: corrupt index");
+        }
+        index_ = (const uint64_t*)(data + indexOffset);
+        indexOffset_ = indexOffset;
+    }
+    
+    size_t count() const {
+        return count_;
+    }
+    
+    GraphData graph(size_t i) const {
+        using namespace graph_container;
+        assert(i < count_);
+        
+        uint64_t offset = index_[i];
+        if(offset < HeaderSize || offset % 8 != 0 || offset + RecordHeaderSize > indexOffset_) {
+            fail("Invalid graph container: corrupt record offset");
+        }
+        const uint32_t* recordHeader = (const uint32_t*)(data_ + offset);
+        uint64_t n = recordHeader[0];
+        uint32_t encoding = recordHeader[1];
+        uint64_t payloadWords = *(const uint64_t*)(data_ + offset + 8);
+        const uint64_t* payload = (const uint64_t*)(data_ + offset + RecordHeaderSize);
+        if(n > INT_MAX || payloadWords > (indexOffset_ - offset - RecordHeaderSize) / 8) {
+            fail("Invalid graph container: corrupt record");
+        }
+        int rowWords = bitSetParam((int)n);
+        
+        if(encoding == Dense) {
+            if(payloadWords != n * rowWords) {
+                fail("Invalid graph container: corrupt record");
+            }
+            for(uint64_t v = 0; v < n; ++v) {
+                const uint64_t* row = payload + v * rowWords;
+                if((row[v >> 6] >> (v & 63)) & 1) {
+                    fail("Invalid graph container: self-loop");
+                }
+                if((n & 63) && (row[rowWords - 1] >> (n & 63))) {
+                    fail("Invalid graph container: edge out of range");
+                }
+            }
+            return GraphData((int)n, payload, owner_);
+        } else if(encoding == Sparse) {
+            vector<pair<int, int>> edges(payloadWords);
+            for(uint64_t e = 0; e < payloadWords; ++e) {
+                uint64_t a = payload[e] & UINT32_MAX;
+                uint64_t b = payload[e] >> 32;
+                if(a >= n || b >= n || a == b) {
+                    fail("Invalid graph container: invalid edge");
+                }
+                edges[e] = make_pair((int)a, (int)b);
+            }
+            return GraphData(SparseGraph((int)n, edges));
+        } else {
+            fail("Invalid graph container: unknown encoding ", encoding);
+            return GraphData();
+        }
+    }
+    
+private:
+    const char* data_;
+    size_t size_;
+    shared_ptr<const void> owner_;
+    const uint64_t* index_;
+    uint64_t indexOffset_;
+    uint64_t count_;
+};
+
+// Calls f for each graph in the input from file descriptor fd, which is either
+// a graph container or a single adjacency matrix in text form.
+template <typename F>
+void readInputGraphs(int fd, F f) {
+    auto input = make_shared<MappedInput>(fd);
+    if(GraphContainer::isContainer(input->data(), input->size())) {
+        GraphContainer container(input->data(), input->size(), input);
+        for(size_t i = 0; i < container.count(); ++i) {
+            GraphData graphData = container.graph(i);
+            f(graphData);
+        }
+    } else {
+        TextInput text(input->data(), input->size());
+        GraphData graphData = GraphData::read(text);
+        f(graphData);
+    }
+}
@@ -1,4 +1,4 @@
-#include "graph.hpp"
+#include "graph_io.hpp"
 
 using namespace std;
 
@@ -6,8 +6,12 @@ int main(int, char**) {
     cin.sync_with_stdio(false);
     cin.tie(nullptr);
     
-    readGraph(cin, [&](auto graph) {
-        graph.toDot(cout);
+    removeStackLimit();
+    
+    readInputGraphs(STDIN_FILENO, [&](const GraphData& graphData) {
+        graphData.accessGraph([&](auto graph) {
+            graph.toDot(cout);
+        });
     });
     
     return 0;
@@ -1,6 +1,10 @@
 #pragma once
 
+#include "arena.hpp"
+#include "cancellation.hpp"
+#include "dp_checkpoint.hpp"
 #include "graph.hpp"
+#include "merge_profile.hpp"
 
 template <int N>
 bool isDirectedEdgeInVStructure(const Graph<N>& graph, int i, int j) {
@@ -58,6 +62,150 @@ bool isValidEssentialGraph(const Graph<N>& graph) {
     return ret;
 }
 
+// The conditions of isValidEssentialGraph on the directed edges of a sparse
+// graph with the given undirected part: the directed edges join distinct
+// chain components that they order acyclically, every parent of a vertex is
+// adjacent to its undirected neighbors, and every directed edge is strongly
+// protected. The chordality of the chain components is not checked. Each
+// condition is checked by marking the neighbors of one vertex at a time, so
+// the time is linear in the size of the graph apart from going through the
+// parents of the undirected neighbors and the heads of the directed edges.
+inline bool hasValidDirectedEdges(const SparseGraph& graph, const SparseGraph& undirected) {
+    int n = graph.size();
+    SparseGraph out = graph.directedPart();
+    if(out.edgeCount() == 0) {
+        return true;
+    }
+    SparseGraph in = out.reversed();
+    auto iterateNeighbors = [&](int x, auto f) {
+        undirected.iterateEdgesOut(x, f);
+        out.iterateEdgesOut(x, f);
+        in.iterateEdgesOut(x, f);
+    };
+    
+    // Label the chain components and order them topologically along the
+    // directed edges
+    vector<int> comp(n, -1);
+    int compCount = 0;
+    vector<int> stack;
+    for(int v = 0; v < n; ++v) {
+        if(comp[v] != -1) {
+            continue;
+        }
+        comp[v] = compCount;
+        stack.push_back(v);
+        while(!stack.empty()) {
+            int x = stack.back();
+            stack.pop_back();
+            undirected.iterateEdgesOut(x, [&](int y) {
+                if(comp[y] == -1) {
+                    comp[y] = compCount;
+                    stack.push_back(y);
+                }
+            });
+        }
+        ++compCount;
+    }
+    vector<pair<int, int>> compEdges;
+    for(int u = 0; u < n; ++u) {
+        bool ok = true;
+        out.iterateEdgesOut(u, [&](int v) {
+            ok = ok && comp[u] != comp[v];
+            compEdges.emplace_back(comp[u], comp[v]);
+        });
+        if(!ok) {
+            return false;
+        }
+    }
+    SparseGraph compGraph(compCount, compEdges);
+    vector<int> inDegree(compCount, 0);
+    for(int c = 0; c < compCount; ++c) {
+        compGraph.iterateEdgesOut(c, [&](int d) {
+            ++inDegree[d];
+        });
+    }
+    for(int c = 0; c < compCount; ++c) {
+        if(inDegree[c] == 0) {
+            stack.push_back(c);
+        }
+    }
+    int sortedCount = 0;
+    while(!stack.empty()) {
+        int c = stack.back();
+        stack.pop_back();
+        ++sortedCount;
+        compGraph.iterateEdgesOut(c, [&](int d) {
+            if(--inDegree[d] == 0) {
+                stack.push_back(d);
+            }
+        });
+    }
+    if(sortedCount != compCount) {
+        return false;
+    }
+    
+    vector<int> neighborMark(n, -1);
+    vector<int> undirectedMark(n, -1);
+    vector<int> childMark(n, -1);
+    vector<int> parentMark(n, -1);
+    for(int u = 0; u < n; ++u) {
+        iterateNeighbors(u, [&](int x) {
+            neighborMark[x] = u;
+        });
+        undirected.iterateEdgesOut(u, [&](int x) {
+            undirectedMark[x] = u;
+        });
+        out.iterateEdgesOut(u, [&](int x) {
+            childMark[x] = u;
+        });
+        in.iterateEdgesOut(u, [&](int x) {
+            parentMark[x] = u;
+        });
+        
+        bool ok = true;
+        undirected.iterateEdgesOut(u, [&](int v) {
+            in.iterateEdgesOut(v, [&](int w) {
+                ok = ok && neighborMark[w] == u;
+            });
+        });
+        out.iterateEdgesOut(u, [&](int v) {
+            // v has a parent not adjacent to u, a parent that is a child of u
+            // or two parents that are undirected neighbors of u
+            bool isProtected = false;
+            int undirectedParents = 0;
+            in.iterateEdgesOut(v, [&](int w) {
+                isProtected = isProtected || (w != u && neighborMark[w] != u) || childMark[w] == u;
+                undirectedParents += undirectedMark[w] == u;
+            });
+            isProtected = isProtected || undirectedParents >= 2;
+            if(!isProtected) {
+                // u has a parent not adjacent to v
+                int adjacentParents = 0;
+                iterateNeighbors(v, [&](int x) {
+                    adjacentParents += parentMark[x] == u;
+                });
+                isProtected = adjacentParents < in.outDegree(u);
+            }
+            ok = ok && isProtected;
+        });
+        if(!ok) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+// isValidEssentialGraph for sparse graphs. The chain components are chordal
+// if and only if the reverse of the order of a maximum cardinality search of
+// the undirected part is a perfect elimination ordering.
+inline bool isValidEssentialGraph(const SparseGraph& graph) {
+    SparseGraph undirected = graph.undirectedPart();
+    return
+        hasValidDirectedEdges(graph, undirected) &&
+        undirected.isReversePerfectEliminationOrdering(undirected.findTreeDecompositionInChordal().order);
+}
+
 template <int N, typename F>
 void iterateMAO_(
     Graph<N>& graph,
@@ -65,6 +213,8 @@ void iterateMAO_(
     int i,
     int j
 ) {
+    pollCancellation();
+    
     int n = graph.size();
     
     if(i >= n) {
@@ -104,6 +254,28 @@ void iterateMAO(Graph<N> graph, F f) {
     iterateMAO_(graph, f, 0, 1);
 }
 
+// Statistics of the tables of intermediate results (DP distributions or
+// memoization tables) built by the counting methods in the current thread.
+// Accumulated until reset, for benchmarking.
+struct CountMAOStats {
+    uint64_t tableCount = 0;
+    uint64_t maxTableSize = 0;
+    uint64_t totalTableSize = 0;
+    
+    void recordTable(size_t size) {
+        ++tableCount;
+        maxTableSize = max(maxTableSize, (uint64_t)size);
+        totalTableSize += size;
+    }
+    
+    void add(const CountMAOStats& other) {
+        tableCount += other.tableCount;
+        maxTableSize = max(maxTableSize, other.maxTableSize);
+        totalTableSize += other.totalTableSize;
+    }
+};
+inline thread_local CountMAOStats countMAOStats;
+
 // mao/enumeration.cpp
 Z countMAOUsingEnumeration(const GraphData& graphData);
 
@@ -119,14 +291,49 @@ Z countMAOUsingDynamicProgramming(const GraphData& graphData);
 // mao/treedecomp.cpp
 Z countMAOUsingTreeDecompositionDP(const GraphData& graphData);
 
+// Structure of the tree decomposition DP for one chain component, for
+// estimating the cost of counting without running the DP. The nodes of the
+// merge tree are listed in post-order; leaves have no children, and their
+// vertCount includes the vertices eliminated at the leaf.
+struct ChainComponentAnalysis {
+    struct MergeNode {
+        int left;
+        int right;
+        int vertCount;
+        int outputCount;
+    };
+    
+    int vertCount;
+    int edgeCount;
+    vector<int> cliqueSizes;
+    
+    // The sizes of the intersections of adjacent cliques in the clique tree,
+    // which are the same for every clique tree of the component
+    vector<int> separatorSizes;
+    
+    vector<MergeNode> mergeTree;
+};
+
+// mao/treedecomp.cpp: the chain components with at least two vertices, with
+// the same merge trees as used by countMAOUsingTreeDecompositionDP
+vector<ChainComponentAnalysis> analyzeChainComponents(const GraphData& graphData);
+
 // mao/treedecomp_sym.cpp
 Z countMAOUsingTreeDecompositionDPSymmetryReduction(const GraphData& graphData);
 
+// mao/portfolio.cpp: races the methods named in portfolioMethods on separate
+// threads for each chain component, takes the first result and cancels the
+// rest. The method list must not be changed while counting. The raced methods
+// do not use the activeDPCheckpoint or activeMergeProfiler of the caller.
+Z countMAOUsingPortfolio(const GraphData& graphData);
+extern vector<string> portfolioMethods;
+
 static const vector<pair<string, Z (*)(const GraphData&)>> countMAOMethods = {
     {"Enumeration", countMAOUsingEnumeration},
     {"He et al. 2015", countMAOUsingHeEtAl2015},
     {"He et al. 2016", countMAOUsingHeEtAl2016},
     {"Dynamic Programming", countMAOUsingDynamicProgramming},
     {"Tree Decomposition DP", countMAOUsingTreeDecompositionDP},
-    {"Symmetry Reduction Tree Decomposition DP", countMAOUsingTreeDecompositionDPSymmetryReduction}
+    {"Symmetry Reduction Tree Decomposition DP", countMAOUsingTreeDecompositionDPSymmetryReduction},
+    {"Portfolio", countMAOUsingPortfolio}
 };
@@ -6,7 +6,7 @@ template <int N>
 using BP = BitSet<bitSetParam(N)>;
 
 template <int N>
-using Mem = unordered_map<BP<N>, Z, hash<BP<N>>, equal_to<BP<N>>, PoolAllocator<pair<const BP<N>, Z>>>;
+using Mem = unordered_map<BP<N>, Z, hash<BP<N>>, equal_to<BP<N>>, ArenaAllocator<pair<const BP<N>, Z>>>;
 
 template <int N>
 Z countInChordal(
@@ -39,13 +39,13 @@ Z countInChordal(
     }
     int a = n * (n - 1) / 2;
     if(e == a - 2) {
-        return (n * (n - 1) - 4) * FactorialTable<N>::get(n - 3);
+        return (n * (n - 1) - 4) * factorial(n - 3);
     }
     if(e == a - 1) {
-        return FactorialTable<N>::get(n - 2) * (2 * n - 3);
+        return factorial(n - 2) * (2 * n - 3);
     }
     if(e == a) {
-        return FactorialTable<N>::get(n);
+        return factorial(n);
     }
     
     Z& ret = mem[mask];
@@ -53,7 +53,10 @@ Z countInChordal(
         return ret;
     }
     
+    // The product for each root reuses the limbs of val
+    Z val;
     for(int v = 0; v < n; ++v) {
+        pollCancellation();
         G newGraph = graph;
         
         B prev(v);
@@ -95,7 +98,7 @@ Z countInChordal(
             cur = next;
         }
         
-        Z val = 1;
+        val = 1;
         newGraph.iterateBidirectionalComponents([&](const auto& comp) {
             val *= countInChordal(mem, newGraph.inducedSubgraph(comp), B::unpack(comp, mask));
         });
@@ -112,6 +115,7 @@ Z count(const Graph<N>& graph) {
     graph.iterateBidirectionalComponents([&](const auto& comp) {
         Mem<N> mem;
         ret *= countInChordal(mem, graph.inducedSubgraph(comp), comp);
+        countMAOStats.recordTable(mem.size());
     });
     return ret;
 }
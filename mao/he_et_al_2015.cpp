@@ -29,17 +29,19 @@ Z countInChordal(const Graph<N>& graph) {
     }
     int a = n * (n - 1) / 2;
     if(e == a - 2) {
-        return (n * (n - 1) - 4) * FactorialTable<N>::get(n - 3);
+        return (n * (n - 1) - 4) * factorial(n - 3);
     }
     if(e == a - 1) {
-        return FactorialTable<N>::get(n - 2) * (2 * n - 3);
+        return factorial(n - 2) * (2 * n - 3);
     }
     if(e == a) {
-        return FactorialTable<N>::get(n);
+        return factorial(n);
     }
     
     Z ret = 0;
+    Z val;
     for(int v = 0; v < n; ++v) {
+        pollCancellation();
         G newGraph = graph;
         
         B prev(v);
@@ -81,7 +83,7 @@ Z countInChordal(const Graph<N>& graph) {
             cur = next;
         }
         
-        Z val = 1;
+        val = 1;
         newGraph.iterateBidirectionalComponents([&](const auto& comp) {
             val *= countInChordal(newGraph.inducedSubgraph(comp));
         });
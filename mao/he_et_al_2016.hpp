@@ -1,57 +1,52 @@
 #pragma once
 
+#include "cancellation.hpp"
 #include "graph.hpp"
 
 namespace he_et_al_2016 {
 
-static const Q ZeroQ = 0;
-
+// Polynomial with rational coefficients, stored as integer coefficients over
+// a common positive denominator so that the arithmetic on the coefficients
+// needs no gcd computations. Only addMul, mul and reduce compute gcds, a
+// constant number per call instead of one per coefficient.
 struct Polynomial {
-    vector<Q> coef;
-    
-    Polynomial() { }
-    Polynomial(vector<Q> coef) : coef(move(coef)) { }
+    vector<Z> coef;
+    Z den;
     
-    const Q& operator[](int i) const {
-        if(i >= (int)coef.size()) {
-            return ZeroQ;
-        } else {
-            return coef[i];
-        }
-    }
-    Q& operator[](int i) {
-        if(i >= (int)coef.size()) {
-            coef.resize(i + 1);
-        }
-        return coef[i];
+    Polynomial() : den(1) { }
+    Polynomial(vector<Z> coef, Z den = 1) : coef(move(coef)), den(move(den)) {
+        assert(this->den > 0);
     }
     
-    Z operator()(int x) {
-        Q ret = 0;
+    // The value at x, which must be an integer
+    Z operator()(int x) const {
+        Z ret = 0;
         if(x == 0) {
-            ret = (*this)[0];
+            if(!coef.empty()) {
+                ret = coef[0];
+            }
         } else {
             for(int i = (int)coef.size() - 1; i >= 0; --i) {
                 ret *= x;
                 ret += coef[i];
             }
         }
-        assert(ret.get_den() == 1);
-        return ret.get_num();
+        assert(mpz_divisible_p(ret.get_mpz_t(), den.get_mpz_t()));
+        mpz_divexact(ret.get_mpz_t(), ret.get_mpz_t(), den.get_mpz_t());
+        return ret;
     }
     
-    Polynomial translate(int d) {
-        Polynomial ret;
-        ret.coef.resize(coef.size());
-        for(int i = 0; i < (int)coef.size(); ++i) {
-            Z binom = 1;
-            Z ds = 1;
-            for(int j = 0; j <= i; ++j) {
-                if(j > 0) {
-                    binom = binom * (i - j + 1) / j;
-                    ds *= d;
-                }
-                ret.coef[i - j] += binom * ds * coef[i];
+    // p(x + d) (x + 1) (x + 2) ... (x + d)
+    Polynomial translate(int d) const {
+        assert(d >= 0);
+        
+        // Taylor shift by Horner's rule, which takes one multiply-add by d
+        // per step and no binomial coefficients
+        Polynomial ret = *this;
+        int n = ret.coef.size();
+        for(int i = 0; i < n - 1; ++i) {
+            for(int j = n - 2; j >= i; --j) {
+                mpz_addmul_ui(ret.coef[j].get_mpz_t(), ret.coef[j + 1].get_mpz_t(), d);
             }
         }
         for(int i = 1; i <= d; ++i) {
@@ -69,18 +64,63 @@ struct Polynomial {
         }
     }
     
-    void addMul(const Polynomial& poly, const Q& c) {
+    // Adds c x^i
+    void addTerm(int i, const Z& c) {
+        if(i >= (int)coef.size()) {
+            coef.resize(i + 1);
+        }
+        coef[i] += c * den;
+    }
+    
+    // Adds poly a / b for b > 0
+    void addMul(const Polynomial& poly, const Z& a, const Z& b) {
+        assert(b > 0);
+        
+        // The common factors of a and the denominator of the term are
+        // cancelled before both terms are brought to the least common
+        // denominator
+        Z polyDen = poly.den * b;
+        Z g = gcd(a, polyDen);
+        polyDen /= g;
+        Z newDen = lcm(den, polyDen);
+        Z selfFactor = newDen / den;
+        Z polyFactor = a / g * (newDen / polyDen);
+        
         coef.resize(max(coef.size(), poly.coef.size()));
+        if(selfFactor != 1) {
+            for(Z& x : coef) {
+                x *= selfFactor;
+            }
+        }
         for(int i = 0; i < (int)poly.coef.size(); ++i) {
-            coef[i] += c * poly.coef[i];
+            mpz_addmul(coef[i].get_mpz_t(), poly.coef[i].get_mpz_t(), polyFactor.get_mpz_t());
         }
+        den = move(newDen);
     }
     
-    void mul(const Q& c) {
-        for(Q& x : coef) {
-            x *= c;
+    void mul(const Z& c) {
+        Z g = gcd(c, den);
+        Z factor = c / g;
+        den /= g;
+        for(Z& x : coef) {
+            x *= factor;
         }
     }
+    
+    // Divides the coefficients and the denominator by their common factors.
+    void reduce() {
+        Z g = den;
+        for(const Z& x : coef) {
+            if(g == 1) {
+                return;
+            }
+            g = gcd(g, x);
+        }
+        for(Z& x : coef) {
+            mpz_divexact(x.get_mpz_t(), x.get_mpz_t(), g.get_mpz_t());
+        }
+        den /= g;
+    }
 };
 
 template <int N>
@@ -93,6 +133,8 @@ template <int N>
 Polynomial computeSizeF(const Graph<N>& K) {
     typedef typename Graph<N>::B B;
     
+    pollCancellation();
+    
     int p = K.size();
     
     if(p == 0) {
@@ -122,7 +164,7 @@ Polynomial computeSizeF(const Graph<N>& K) {
     }
     if(isolatedEdgeGraph) {
         Z e = (Z)1 << (p / 2 - 1);
-        return Polynomial({2 * e, Q(3 * p * e) / 2, Q(p * e) / 2});
+        return Polynomial({4 * e, 3 * p * e, p * e}, 2);
     }
     
     B dom = K.vertexSet();
@@ -147,7 +189,7 @@ Polynomial computeSizeF(const Graph<N>& K) {
         Graph<N> newK = K.inducedSubgraph(nonIsol);
         int k = isol.count();
         Polynomial poly = computeSizeF(newK);
-        poly[1] += computeSize(newK) * k;
+        poly.addTerm(1, computeSize(newK) * k);
         return poly;
     }
     
@@ -170,7 +212,7 @@ Z computeSize(const Graph<N>& C) {
         Graph<N> Kj = Cj.inducedSubgraph(nonDom);
         int mj = dom.count();
         
-        ret *= computeSizeF(Kj)(mj) * FactorialTable<N>::get(mj);
+        ret *= computeSizeF(Kj)(mj) * factorial(mj);
     });
     assert(ret > 0);
     return ret;
@@ -179,6 +221,7 @@ Z computeSize(const Graph<N>& C) {
 template <int N>
 Z computeRootedSize(const Graph<N>& graph, int v) {
     typedef typename Graph<N>::B B;
+    pollCancellation();
     Graph<N> newGraph = graph;
     
     B prev(v);
@@ -244,10 +287,11 @@ Polynomial computeSizeGF(const Graph<N>& K) {
             Polynomial SFKjNv = computeSizeF(KjNv);
             SKj += SKjv;
             
-            poly.addMul(SFKjNv, Q(SKjv) / SFKjNv(0));
+            // SFKjNv / SFKjNv(0), where the denominator of SFKjNv cancels
+            poly.addMul(SFKjNv, SKjv * SFKjNv.den, SFKjNv.coef[0]);
         }
         
-        bpoly.addMul(poly, Q(1) / SKj);
+        bpoly.addMul(poly, 1, SKj);
         
         SK *= SKj;
     });
@@ -256,22 +300,48 @@ Polynomial computeSizeGF(const Graph<N>& K) {
     int d = bpoly.coef.size() - 1;
     assert(d >= 0);
     
+    // The result is the polynomial with poly(0) = SK and
+    // poly(x) - poly(x - 1) = bpoly(x). If the forward differences of the
+    // numerator of bpoly at 1 are c_0, ..., c_d, then
+    // poly(x) = SK + sum_k c_k binom(x, k + 1) / bpoly.den, so all the
+    // coefficients are integers over bpoly.den (d + 1)!
+    vector<Z> diffs(d + 1);
+    for(int x = 1; x <= d + 1; ++x) {
+        Z& val = diffs[x - 1];
+        for(int i = d; i >= 0; --i) {
+            val *= x;
+            val += bpoly.coef[i];
+        }
+    }
+    for(int k = 1; k <= d; ++k) {
+        for(int x = d; x >= k; --x) {
+            diffs[x] -= diffs[x - 1];
+        }
+    }
+    
     Polynomial poly;
     poly.coef.resize(d + 2);
-    poly.coef[0] = SK;
-    poly.coef[d + 1] = bpoly.coef[d] / (d + 1);
-    for(int i = d; i >= 1; --i) {
-        Q val = bpoly.coef[i - 1];
-        
-        Z aval = i;
-        for(int j = i + 1; j <= d + 1; ++j) {
-            aval = -(aval * j) / (j - i + 1);
-            val -= aval * poly.coef[j];
+    poly.den = bpoly.den * factorial(d + 1);
+    poly.coef[0] = SK * poly.den;
+    
+    // Adds c_k (d + 1)! / (k + 1)! x (x - 1) ... (x - k) for each k, building
+    // the falling factorials one factor at a time
+    vector<Z> falling = {0, 1};
+    Z scale = factorial(d + 1);
+    for(int k = 0; k <= d; ++k) {
+        if(k > 0) {
+            falling.push_back(0);
+            for(int i = k + 1; i >= 1; --i) {
+                falling[i] = falling[i - 1] - k * falling[i];
+            }
+            mpz_divexact_ui(scale.get_mpz_t(), scale.get_mpz_t(), k + 1);
+        }
+        Z c = diffs[k] * scale;
+        for(int i = 1; i <= k + 1; ++i) {
+            mpz_addmul(poly.coef[i].get_mpz_t(), falling[i].get_mpz_t(), c.get_mpz_t());
         }
-        val /= i;
-        
-        poly.coef[i] = val;
     }
+    poly.reduce();
     
     return poly;
 }
@@ -0,0 +1,193 @@
+#include "mao.hpp"
+
+#include <condition_variable>
+#include <mutex>
+
+#include <pthread.h>
+
+vector<string> portfolioMethods = {
+    "Dynamic Programming",
+    "He et al. 2016",
+    "Symmetry Reduction Tree Decomposition DP"
+};
+
+namespace {
+
+typedef Z (*Method)(const GraphData&);
+
+// Chain components smaller than this are counted in the calling thread using
+// the first method, as every method is faster than starting the threads.
+const int MinRacedComponentSize = 16;
+
+// The recursive methods need deep stacks, which the default thread stack size
+// does not allow. The stack is only reserved, not committed.
+const size_t WorkerStackSize = (size_t)1 << 30;
+
+// Thread with a large stack, joined on destruction.
+class WorkerThread {
+public:
+    explicit WorkerThread(function<void()> f) : f_(move(f)) {
+        pthread_attr_t attr;
+        if(pthread_attr_init(&attr)) fail("Initializing thread attributes failed");
+        if(pthread_attr_setstacksize(&attr, WorkerStackSize)) fail("Setting thread stack size failed");
+        if(pthread_create(&thread_, &attr, run_, this)) fail("Creating thread failed");
+        pthread_attr_destroy(&attr);
+    }
+    
+    WorkerThread(const WorkerThread&) = delete;
+    WorkerThread& operator=(const WorkerThread&) = delete;
+    
+    ~WorkerThread() {
+        if(pthread_join(thread_, nullptr)) fail("Joining thread failed");
+    }
+    
+private:
+    function<void()> f_;
+    pthread_t thread_;
+    
+    static void* run_(void* self) {
+        ((WorkerThread*)self)->f_();
+        return nullptr;
+    }
+};
+
+vector<Method> selectedMethods() {
+    vector<Method> ret;
+    for(const string& name : portfolioMethods) {
+        Method method = nullptr;
+        for(const auto& p : countMAOMethods) {
+            if(p.first == name) {
+                method = p.second;
+            }
+        }
+        if(method == nullptr) {
+            fail("Unknown portfolio method '", name, "'");
+        }
+        if(method == countMAOUsingPortfolio) {
+            fail("Portfolio cannot contain itself");
+        }
+        ret.push_back(method);
+    }
+    if(ret.empty()) {
+        fail("No portfolio methods given");
+    }
+    return ret;
+}
+
+Z race(const GraphData& graphData, const vector<Method>& methods) {
+    int methodCount = methods.size();
+    
+    mutex mtx;
+    condition_variable stopped;
+    bool done = false;
+    int stoppedCount = 0;
+    Z result;
+    CountMAOStats resultStats;
+    uint64_t resultArenaPeak = 0;
+    exception_ptr error;
+    
+    vector<unique_ptr<CancellationToken>> tokens;
+    for(int i = 0; i < methodCount; ++i) {
+        tokens.push_back(make_unique<CancellationToken>());
+    }
+    
+    vector<unique_ptr<WorkerThread>> workers;
+    auto stopWorkers = [&]() {
+        for(const unique_ptr<CancellationToken>& token : tokens) {
+            token->cancel();
+        }
+        // Joining waits for the cancelled methods to unwind, which releases
+        // their memory
+        workers.clear();
+    };
+    
+    for(int i = 0; i < methodCount; ++i) {
+        workers.push_back(make_unique<WorkerThread>([&, i]() {
+            activeCancellationToken = tokens[i].get();
+            Z count;
+            bool ok = false;
+            exception_ptr workerError;
+            try {
+                count = methods[i](graphData);
+                ok = true;
+            } catch(const CountMAOCancelled&) {
+            } catch(...) {
+                workerError = current_exception();
+            }
+            activeCancellationToken = nullptr;
+            
+            {
+                lock_guard<mutex> lock(mtx);
+                if(ok && !done) {
+                    done = true;
+                    result = count;
+                    resultStats = countMAOStats;
+                    resultArenaPeak = arenaStats.peakBytesInUse;
+                }
+                if(workerError && !error) {
+                    error = workerError;
+                }
+                ++stoppedCount;
+            }
+            stopped.notify_all();
+        }));
+    }
+    
+    // Wait for the first result, checking the limits of the caller meanwhile
+    CancellationToken* outer = activeCancellationToken;
+    try {
+        unique_lock<mutex> lock(mtx);
+        while(!done && stoppedCount < methodCount) {
+            if(outer) {
+                lock.unlock();
+                outer->check();
+                lock.lock();
+            }
+            stopped.wait_for(lock, chrono::milliseconds(10), [&]() {
+                return done || stoppedCount == methodCount;
+            });
+        }
+    } catch(const CountMAOCancelled&) {
+        stopWorkers();
+        throw;
+    }
+    stopWorkers();
+    
+    if(!done) {
+        if(error) {
+            rethrow_exception(error);
+        }
+        fail("All portfolio methods were cancelled");
+    }
+    countMAOStats.add(resultStats);
+    // The winner used its arenas on top of the ones held by this thread
+    arenaStats.peakBytesInUse = max(arenaStats.peakBytesInUse, arenaStats.bytesInUse + resultArenaPeak);
+    return result;
+}
+
+}
+
+Z countMAOUsingPortfolio(const GraphData& graphData) {
+    vector<Method> methods = selectedMethods();
+    
+    // Only the tree decomposition DP has a pipeline for graphs this large
+    if(graphData.size() > DefaultMaxGraphSize) {
+        return countMAOUsingTreeDecompositionDP(graphData);
+    }
+    
+    Z ret = 1;
+    graphData.accessGraph([&](auto graph) {
+        assert(isValidEssentialGraph(graph));
+        graph.iterateBidirectionalComponents([&](const auto& comp) {
+            graph.inducedSubgraphReSelectN(comp, [&](const auto& subgraph) {
+                GraphData subgraphData(subgraph);
+                if(subgraph.size() < MinRacedComponentSize) {
+                    ret *= methods[0](subgraphData);
+                } else {
+                    ret *= race(subgraphData, methods);
+                }
+            });
+        });
+    });
+    return ret;
+}
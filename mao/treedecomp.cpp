@@ -1,14 +1,14 @@
 #include "mao.hpp"
 #include "full_binary_tree.hpp"
+#include "mao/treedecomp.hpp"
+#include "mao/treedecomp_dist.hpp"
 
-#include <deque>
 #include <cstdlib>
 #include <new>
 
 namespace {
 
-template <int N>
-using BP = BitSet<bitSetParam(N)>;
+using namespace treedecomp;
 
 // Pre-Merge Tree, phase 1: The tree where leaves are the cliques in the graph and inner nodes specify the order in which they are merged
 template <int N>
@@ -183,216 +183,443 @@ int maxVertCount(const MergeTree<N>& mergeTree) {
     );
 }
 
-template <int N>
-struct Seq {
-    typedef typename conditional<N <= 256, uint8_t, int>::type Elem;
-    Elem elems[N];
-    
-    Seq() : elems() { }
-    
-    const Elem& operator[](int i) const {
-        return elems[i];
-    }
-    Elem& operator[](int i) {
-        return elems[i];
-    }
-    
-    bool operator<(const Seq& b) const {
-        return fastMemoryComparisonLess<N * sizeof(Elem)>((void*)elems, (void*)b.elems);
-    }
-    bool operator==(const Seq& b) const {
-        return fastMemoryComparisonEqual<N * sizeof(Elem)>((void*)elems, (void*)b.elems);
+// A dense output stores at most this many states, and it is used if at least
+// MinDenseFill of them are predicted to be reached.
+const uint64_t MaxDenseStates = (uint64_t)1 << 20;
+const double MinDenseFill = 0.25;
+
+// Predicts whether most states of the output of a combine are reached. Each
+// state of a sequence of a may meet every state of the matching sequence of
+// b, so the number of sets of lost predecessors per output sequence is
+// estimated as the product of the average numbers per sequence of a and b.
+inline bool useDenseOutput(uint64_t aSize, int aLength, uint64_t bSize, int bLength, int outputLength) {
+    double capacity = factorial(outputLength).get_d() * exp2(outputLength);
+    if(capacity > MaxDenseStates) {
+        return false;
     }
-};
+    double aPerSeq = (double)aSize / factorial(aLength).get_d();
+    double bPerSeq = (double)bSize / factorial(bLength).get_d();
+    return aPerSeq * bPerSeq >= MinDenseFill * exp2(outputLength);
+}
+
+template <int N>
+SubtreeDist<N> dpSubtree(const MergeTree<N>& mergeTree, const MergeTreeCheckpoints* checkpoints);
 
 template <int N>
-using State = pair<Seq<N>, BP<N>>;
+SubtreeDist<N> evaluateSubtree(const MergeTree<N>& mergeTree, const MergeTreeCheckpoints* checkpoints) {
+    return mergeTree.visit(
+        [&](const auto& node) -> SubtreeDist<N> {
+            MergeProfiler* profiler = activeMergeProfiler;
+            MergeProfileNode profile;
+            if(profiler) {
+                profile.start = profiler->now();
+            }
+            
+            SubtreeDist<N> left = dpSubtree(node.left, checkpoints);
+            if(profiler) {
+                profile.left = profiler->lastIndex();
+            }
+            SubtreeDist<N> right = dpSubtree(node.right, checkpoints);
+            
+            double selfStart = profiler ? profiler->now() : 0.0;
+            uint64_t bytesStart = arenaStats.bytesAllocated;
+            bool dense = false;
+            if constexpr(N <= MaxRankedVertCount) {
+                dense = useDenseOutput(
+                    distSize<N>(left), node.vertCount,
+                    distSize<N>(right), node.rightMask.count(),
+                    node.outputMask.count()
+                );
+            }
+            SubtreeDist<N> dist = visit([&](const auto& l, const auto& r) {
+                return combine<N>(l, r, node.vertCount, node.rightMask, node.outputMask, dense, profile.counts);
+            }, left, right);
+            countMAOStats.recordTable(distSize<N>(dist));
+            
+            if(profiler) {
+                profile.right = profiler->lastIndex();
+                profile.vertCount = node.vertCount;
+                profile.leftSize = distSize<N>(left);
+                profile.rightSize = distSize<N>(right);
+                profile.outputSize = distSize<N>(dist);
+                profile.bytesAllocated = arenaStats.bytesAllocated - bytesStart;
+                profile.end = profiler->now();
+                profile.selfSeconds = profile.end - selfStart;
+                profiler->add(profile);
+            }
+            return dist;
+        },
+        [&](const auto& leaf) -> SubtreeDist<N> {
+            // No table is built for the leaf, but its size is profiled as
+            // if it were
+            MergeProfiler* profiler = activeMergeProfiler;
+            double start = profiler ? profiler->now() : 0.0;
+            LeafDist<N> dist(leaf.outputCount, leaf.extraCount);
+            
+            if(profiler) {
+                MergeProfileNode profile;
+                profile.vertCount = leaf.outputCount + leaf.extraCount;
+                profile.outputSize = dist.size();
+                profile.start = start;
+                profile.end = profiler->now();
+                profile.selfSeconds = profile.end - start;
+                profiler->add(profile);
+            }
+            return dist;
+        }
+    );
+}
 
 template <int N>
-using Dist = map<State<N>, Z, less<State<N>>, PoolAllocator<pair<const State<N>, Z>>>;
+int subtreeOutputCount(const MergeTree<N>& mergeTree) {
+    return mergeTree.visit(
+        [&](const auto& node) {
+            return node.outputMask.count();
+        },
+        [&](const auto& leaf) {
+            return leaf.outputCount;
+        }
+    );
+}
 
+// Evaluates the subtree, or loads its output from a checkpoint saved by an
+// earlier run. Once the output of a slow subtree has been saved, the
+// checkpoints of its children are no longer needed.
 template <int N>
-struct Contractor {
-    typedef BP<N> B;
-    
-    Contractor(int srcSize, B mask)
-        : srcSize(srcSize),
-          size(mask.count()),
-          mask(mask)
-    {
-        assert(srcSize <= N);
-        assert(isSubset(mask, B::range(srcSize)));
-        int pos = 0;
-        mask.iterate([&](int j) {
-            vertexMap[j] = pos++;
-        });
+SubtreeDist<N> dpSubtree(const MergeTree<N>& mergeTree, const MergeTreeCheckpoints* checkpoints) {
+    // Leaves are evaluated in time linear in the number of output vertices,
+    // so they are never checkpointed
+    if(checkpoints == nullptr || mergeTree.isLeaf()) {
+        return evaluateSubtree(mergeTree, checkpoints);
     }
     
-    int srcSize;
-    int size;
-    B mask;
-    typename Seq<N>::Elem vertexMap[N];
+    MergeProfiler* profiler = activeMergeProfiler;
+    double profileStart = profiler ? profiler->now() : 0.0;
+    string path = checkpoints->path(&mergeTree);
+    int outputCount = subtreeOutputCount(mergeTree);
     
-    struct Result {
-        Seq<N> seq;
-        B origLostPred;
-        B chosenMask;
-    };
+    CheckpointReader in(path);
+    if(in.isOpen()) {
+        Dist<N> dist = readCheckpointDist<Dist<N>>(in, StateCodec<N>(outputCount), outputCount);
+        in.finish();
+        checkpoints->dir().recordLoad();
+        countMAOStats.recordTable(dist.size());
+        if(profiler) {
+            MergeProfileNode profile;
+            profile.vertCount = outputCount;
+            profile.outputSize = dist.size();
+            profile.start = profileStart;
+            profile.end = profiler->now();
+            profile.selfSeconds = profile.end - profileStart;
+            profiler->add(profile);
+        }
+        return dist;
+    }
     
-    Result operator()(const Seq<N>& seq) {
-        Result ret;
-        
-        bool removed = false;
-        int pos = 0;
-        
-        for(int i = 0; i < srcSize; ++i) {
-            int j = seq[i];
-            assert(j >= 0 && j < srcSize);
-            if(mask.has(j)) {
-                if(removed) {
-                    ret.origLostPred.add(i);
-                }
-                ret.chosenMask.add(i);
-                ret.seq[pos++] = vertexMap[j];
+    auto start = chrono::steady_clock::now();
+    SubtreeDist<N> dist = evaluateSubtree(mergeTree, checkpoints);
+    if(chrono::duration<double>(chrono::steady_clock::now() - start).count() >= checkpoints->dir().minSeconds()) {
+        CheckpointWriter out(path);
+        visit([&](const auto& d) {
+            typedef typename decay<decltype(d)>::type D;
+            if constexpr(is_same<D, Dist<N>>::value) {
+                writeCheckpointDist(out, d, StateCodec<N>(outputCount), outputCount);
+            } else if constexpr(is_same<D, DenseDist<N>>::value) {
+                writeCheckpointDist(out, sparseDist<N>(d), StateCodec<N>(outputCount), outputCount);
             } else {
-                removed = true;
+                fail("Leaf distributions are not checkpointed");
             }
-        }
-        
-        assert(pos == size);
-        
-        return ret;
+        }, dist);
+        out.commit();
+        checkpoints->dir().recordSave();
+        mergeTree.visit(
+            [&](const auto& node) {
+                checkpoints->remove(&node.left);
+                checkpoints->remove(&node.right);
+            },
+            [&](const auto&) { }
+        );
     }
-};
+    return dist;
+}
 
 template <int N>
-Dist<N> singletonDist(int outputCount, int extraCount) {
-    typedef BP<N> B;
+Z countMergeTree(const MergeTree<N>& mergeTree, uint64_t graphHash) {
+    unique_ptr<MergeTreeCheckpoints> checkpoints;
+    if(activeDPCheckpoint) {
+        checkpoints = make_unique<MergeTreeCheckpoints>(*activeDPCheckpoint, "td", graphHash, mergeTree);
+    }
+    SubtreeDist<N> dist = dpSubtree(mergeTree, checkpoints.get());
     
-    int a = outputCount;
-    int b = extraCount;
-    int n = a + b;
+    return lambdaVisit(dist,
+        [&](const Dist<N>& d) {
+            Z ret = 0;
+            for(const pair<const StateKey<N>, Z>& p : d) {
+                ret += p.second;
+            }
+            return ret;
+        },
+        [&](const auto& d) {
+            return d.total();
+        }
+    );
+}
+
+template <int N, int SrcN>
+Z count(const MergeTree<SrcN>& srcMergeTree, uint64_t graphHash) {
+    return countMergeTree(convertMergeTree<N>(srcMergeTree), graphHash);
+}
+
+template <int N>
+Z count(const Graph<N>& graph, uint64_t graphHash) {
+    assert(isValidEssentialGraph(graph));
     
-    assert(outputCount <= N);
-    Seq<N> seq;
-    for(int i = 0; i < outputCount; ++i) {
-        seq[i] = i;
-    }
+    Z ret = 1;
+    graph.iterateBidirectionalComponents([&](const auto& comp) {
+        Graph<N> subgraph = graph.inducedSubgraph(comp);
+        auto decomp = subgraph.findTreeDecompositionInChordal();
+        MergeTree<N> mergeTree = createMergeTree<N>(decomp);
+        select2Pow<ceilLog2(N)>(maxVertCount(mergeTree), [&](auto sel) {
+            ret *= count<sel.Val>(mergeTree, graphHash);
+        });
+    });
+    return ret;
+}
+
+// Sparse pipeline: the merge tree is built directly from the clique tree of a
+// chain component found by SparseGraph, with the vertex sets of each merge
+// given as masks over the positions in the sorted clique. Thus the sizes of the
+// bit sets are bounded by the size of the largest clique instead of the number
+// of vertices.
+
+// Maps the vertices of src given by mask to positions in dest, dropping the
+// ones not in dest.
+template <int N>
+BP<N> translateCliqueMask(const vector<int>& src, BP<N> mask, const vector<int>& dest) {
+    BP<N> ret;
+    size_t j = 0;
+    mask.iterate([&](int i) {
+        while(j < dest.size() && dest[j] < src[i]) {
+            ++j;
+        }
+        if(j < dest.size() && dest[j] == src[i]) {
+            ret.add(j);
+        }
+    });
+    return ret;
+}
+
+// Equivalent to createMergeTree for the subtree of the clique tree rooted at
+// clique idx, with the given output vertices as positions in the clique.
+template <int N>
+MergeTree<N> createSparseMergeTree(
+    const SparseGraph::TreeDecomposition& dec,
+    const vector<vector<int>>& children,
+    int idx,
+    BP<N> outputVerts
+) {
+    typedef BP<N> B;
+    const vector<int>& clique = dec.cliques[idx];
+    int childCount = children[idx].size();
     
-    Dist<N> dist;
+    // The clique is merged with its children in order, the last merge being
+    // the root. The vertices needed from the children do not depend on the
+    // output, so we can find them first and then propagate the outputs from
+    // the root merge down to the leaf.
+    vector<MergeTree<N>> rights(childCount);
+    vector<B> rightVerts(childCount);
+    for(int i = 0; i < childCount; ++i) {
+        const vector<int>& childClique = dec.cliques[children[idx][i]];
+        B childOutput = translateCliqueMask<N>(clique, B::range(clique.size()), childClique);
+        rights[i] = createSparseMergeTree<N>(dec, children, children[idx][i], childOutput);
+        rightVerts[i] = translateCliqueMask<N>(childClique, childOutput, clique);
+    }
     
-    Z bFact = 1;
-    for(int i = 2; i <= b; ++i) {
-        bFact *= i;
+    vector<B> outputs(childCount + 1);
+    outputs[childCount] = outputVerts;
+    for(int i = childCount - 1; i >= 0; --i) {
+        outputs[i] = setUnion(outputs[i + 1], rightVerts[i]);
     }
     
-    if(b == 0) {
-        do {
-            dist[{seq, B()}] = bFact;
-        } while(next_permutation(seq.elems, seq.elems + outputCount));
-    } else {
-        pair<B, Z> vals[N + 1];
-        vals[a] = make_pair(B(), bFact);
-        for(int i = a - 1; i >= 0; --i) {
-            vals[i] = make_pair(
-                vals[i + 1].first.with(i),
-                vals[i + 1].second * (n - i - 1) / (a - i)
-            );
-        }
-        
-        do {
-            for(int i = 0; i <= a; ++i) {
-                dist[{seq, vals[i].first}] = vals[i].second;
-            }
-        } while(next_permutation(seq.elems, seq.elems + outputCount));
+    MergeTree<N> ret(MergeLeaf{
+        outputs[0].count(),
+        (int)clique.size() - outputs[0].count()
+    });
+    for(int i = 0; i < childCount; ++i) {
+        ret = MergeTree<N>(
+            {
+                outputs[i].count(),
+                B::pack(outputs[i + 1], outputs[i]),
+                B::pack(rightVerts[i], outputs[i])
+            },
+            move(ret),
+            move(rights[i])
+        );
     }
     
-    return dist;
+    return ret;
 }
 
-template <int N>
-Dist<N> combine(const Dist<N>& a, const Dist<N>& b, int vertCount, BP<N> bMask, BP<N> outputMask) {
-    typedef BP<N> B;
-    
-    Dist<N> dist;
+// Calls f(dec, children, root, cliques) for the clique tree of each chain
+// component of the graph with at least two vertices, where cliques lists the
+// indices of the cliques in the tree. undirected is the undirected part of
+// the graph. Fails if the graph is not a valid essential graph, which is
+// checked on the order of the maximum cardinality search that finds the
+// cliques.
+template <typename F>
+void iterateSparseChainComponents(const SparseGraph& graph, const SparseGraph& undirected, F f) {
+    SparseGraph::TreeDecomposition dec = undirected.findTreeDecompositionInChordal();
+    if(
+        !undirected.isReversePerfectEliminationOrdering(dec.order) ||
+        !hasValidDirectedEdges(graph, undirected)
+    ) {
+        fail("Invalid input: the graph is not a valid essential graph");
+    }
     
-    Contractor<N> bContractor(vertCount, bMask);
-    Contractor<N> outputContractor(vertCount, outputMask);
+    int cliqueCount = dec.cliques.size();
+    vector<vector<int>> children(cliqueCount);
+    for(int i = 0; i < cliqueCount; ++i) {
+        if(dec.parents[i] != -1) {
+            children[dec.parents[i]].push_back(i);
+        }
+    }
     
-    auto ai = a.begin();
-    while(ai != a.end()) {
-        const Seq<N>& seq = ai->first.first;
-        
-        typename Contractor<N>::Result bContraction = bContractor(seq);
-        typename Contractor<N>::Result outputContraction = outputContractor(seq);
-        
-        auto bs = b.lower_bound({bContraction.seq, B()});
-        auto be = b.upper_bound({bContraction.seq, B::ones()});
+    // The roots of the clique forest correspond to the chain components
+    vector<int> cliques;
+    for(int root = 0; root < cliqueCount; ++root) {
+        if(dec.parents[root] != -1 || (dec.cliques[root].size() == 1 && children[root].empty())) {
+            continue;
+        }
         
-        for(; ai != a.end() && ai->first.first == seq; ++ai) {
-            for(auto bi = bs; bi != be; ++bi) {
-                if(setIntersection(
-                    setUnion(ai->first.second, bContraction.origLostPred),
-                    B::unpack(bi->first.second, bContraction.chosenMask)
-                ).isEmpty()) {
-                    B lostPred = setUnion(
-                        setUnion(
-                            ai->first.second,
-                            B::unpack(bi->first.second, bContraction.chosenMask)
-                        ),
-                        outputContraction.origLostPred
-                    );
-                    lostPred = B::pack(lostPred, outputContraction.chosenMask);
-                    Z count = ai->second * bi->second;
-                    dist[{outputContraction.seq, lostPred}] += count;
-                }
-            }
+        cliques.clear();
+        cliques.push_back(root);
+        for(size_t i = 0; i < cliques.size(); ++i) {
+            const vector<int>& c = children[cliques[i]];
+            cliques.insert(cliques.end(), c.begin(), c.end());
         }
+        
+        f(dec, children, root, cliques);
     }
-    
-    return dist;
 }
 
+template <typename F>
+void selectSparseMergeTreeParam(
+    const SparseGraph::TreeDecomposition& dec,
+    const vector<int>& cliques,
+    F f
+) {
+    int maxCliqueSize = 0;
+    for(int idx : cliques) {
+        maxCliqueSize = max(maxCliqueSize, (int)dec.cliques[idx].size());
+    }
+    select2Pow<ceilLog2(DefaultMaxGraphSize)>(maxCliqueSize, f);
+}
+
+Z countSparse(const SparseGraph& graph, uint64_t graphHash) {
+    Z ret = 1;
+    iterateSparseChainComponents(graph, graph.undirectedPart(), [&](
+        const SparseGraph::TreeDecomposition& dec,
+        const vector<vector<int>>& children,
+        int root,
+        const vector<int>& cliques
+    ) {
+        selectSparseMergeTreeParam(dec, cliques, [&](auto sel) {
+            const int N = sel.Val;
+            ret *= countMergeTree(createSparseMergeTree<N>(dec, children, root, BP<N>()), graphHash);
+        });
+    });
+    return ret;
+}
+
+// Appends the nodes of the merge tree to output in post-order and returns the
+// index of the root.
 template <int N>
-Dist<N> dpSubtree(const MergeTree<N>& mergeTree) {
+int appendMergeTreeShape(const MergeTree<N>& mergeTree, vector<ChainComponentAnalysis::MergeNode>& output) {
     return mergeTree.visit(
         [&](const auto& node) {
-            Dist<N> left = dpSubtree(node.left);
-            Dist<N> right = dpSubtree(node.right);
-            return combine(left, right, node.vertCount, node.rightMask, node.outputMask);
+            ChainComponentAnalysis::MergeNode shape;
+            shape.left = appendMergeTreeShape(node.left, output);
+            shape.right = appendMergeTreeShape(node.right, output);
+            shape.vertCount = node.vertCount;
+            shape.outputCount = node.outputMask.count();
+            output.push_back(shape);
+            return (int)output.size() - 1;
         },
         [&](const auto& leaf) {
-            return singletonDist<N>(leaf.outputCount, leaf.extraCount);
+            output.push_back({-1, -1, leaf.outputCount + leaf.extraCount, leaf.outputCount});
+            return (int)output.size() - 1;
         }
     );
 }
 
-template <int N, int SrcN>
-Z count(const MergeTree<SrcN>& srcMergeTree) {
-    MergeTree<N> mergeTree = convertMergeTree<N>(srcMergeTree);
-    
-    Dist<N> dist = dpSubtree(mergeTree);
-    
-    Z ret = 0;
-    for(const pair<State<N>, Z>& p : dist) {
-        ret += p.second;
-    }
-    
-    return ret;
-}
-
 template <int N>
-Z count(const Graph<N>& graph) {
-    assert(isValidEssentialGraph(graph));
-    
-    Z ret = 1;
+vector<ChainComponentAnalysis> analyze(const Graph<N>& graph) {
+    vector<ChainComponentAnalysis> ret;
     graph.iterateBidirectionalComponents([&](const auto& comp) {
+        if(comp.count() < 2) {
+            return;
+        }
+        
         Graph<N> subgraph = graph.inducedSubgraph(comp);
         auto decomp = subgraph.findTreeDecompositionInChordal();
-        MergeTree<N> mergeTree = createMergeTree<N>(decomp);
-        select2Pow<ceilLog2(N)>(maxVertCount(mergeTree), [&](auto sel) {
-            ret *= count<sel.Val>(mergeTree);
+        
+        ChainComponentAnalysis analysis;
+        analysis.vertCount = subgraph.size();
+        analysis.edgeCount = 0;
+        for(int v = 0; v < subgraph.size(); ++v) {
+            analysis.edgeCount += subgraph.neighbors(v).count();
+        }
+        analysis.edgeCount /= 2;
+        for(int i = 0; i < decomp.structure.size(); ++i) {
+            analysis.cliqueSizes.push_back(decomp.cliques[i].count());
+            decomp.structure.edgesOut(i).iterate([&](int j) {
+                if(i < j) {
+                    analysis.separatorSizes.push_back(setIntersection(decomp.cliques[i], decomp.cliques[j]).count());
+                }
+            });
+        }
+        appendMergeTreeShape(createMergeTree<N>(decomp), analysis.mergeTree);
+        ret.push_back(move(analysis));
+    });
+    return ret;
+}
+
+vector<ChainComponentAnalysis> analyzeSparse(const SparseGraph& graph) {
+    vector<ChainComponentAnalysis> ret;
+    SparseGraph undirected = graph.undirectedPart();
+    vector<int> mark(graph.size(), -1);
+    iterateSparseChainComponents(graph, undirected, [&](
+        const SparseGraph::TreeDecomposition& dec,
+        const vector<vector<int>>& children,
+        int root,
+        const vector<int>& cliques
+    ) {
+        ChainComponentAnalysis analysis;
+        analysis.vertCount = 0;
+        analysis.edgeCount = 0;
+        for(int idx : cliques) {
+            const vector<int>& clique = dec.cliques[idx];
+            analysis.cliqueSizes.push_back(clique.size());
+            if(dec.parents[idx] != -1) {
+                const vector<int>& parent = dec.cliques[dec.parents[idx]];
+                vector<int> separator;
+                set_intersection(clique.begin(), clique.end(), parent.begin(), parent.end(), back_inserter(separator));
+                analysis.separatorSizes.push_back(separator.size());
+            }
+            for(int v : clique) {
+                if(mark[v] != root) {
+                    mark[v] = root;
+                    ++analysis.vertCount;
+                    analysis.edgeCount += undirected.outDegree(v);
+                }
+            }
+        }
+        analysis.edgeCount /= 2;
+        selectSparseMergeTreeParam(dec, cliques, [&](auto sel) {
+            const int N = sel.Val;
+            appendMergeTreeShape(createSparseMergeTree<N>(dec, children, root, BP<N>()), analysis.mergeTree);
         });
+        ret.push_back(move(analysis));
     });
     return ret;
 }
@@ -400,9 +627,27 @@ Z count(const Graph<N>& graph) {
 }
 
 Z countMAOUsingTreeDecompositionDP(const GraphData& graphData) {
+    uint64_t graphHash = activeDPCheckpoint ? graphData.hash() : 0;
+    
+    if(graphData.isSparse() || graphData.size() > DefaultMaxGraphSize) {
+        return countSparse(*graphData.sparseGraph(), graphHash);
+    }
+    
     Z ret;
     graphData.accessGraph([&](auto graph) {
-        ret = count(graph);
+        ret = count(graph, graphHash);
+    });
+    return ret;
+}
+
+vector<ChainComponentAnalysis> analyzeChainComponents(const GraphData& graphData) {
+    if(graphData.isSparse() || graphData.size() > DefaultMaxGraphSize) {
+        return analyzeSparse(*graphData.sparseGraph());
+    }
+    
+    vector<ChainComponentAnalysis> ret;
+    graphData.accessGraph([&](auto graph) {
+        ret = analyze(graph);
     });
     return ret;
 }
@@ -0,0 +1,354 @@
+#pragma once
+
+#include "bitset.hpp"
+
+#include <utility>
+
+// Sequences of the tree decomposition DP engines and the kernels that
+// contract and rank them, shared by mao/treedecomp.cpp and
+// mao/treedecomp_sym.cpp.
+namespace treedecomp {
+
+template <int N>
+using BP = BitSet<bitSetParam(N)>;
+
+template <int N>
+struct Seq {
+    typedef typename conditional<N <= 256, uint8_t, int>::type Elem;
+    Elem elems[N];
+    
+    Seq() : elems() { }
+    
+    const Elem& operator[](int i) const {
+        return elems[i];
+    }
+    Elem& operator[](int i) {
+        return elems[i];
+    }
+    
+    bool operator<(const Seq& b) const {
+        return fastMemoryComparisonLess<N * sizeof(Elem)>((void*)elems, (void*)b.elems);
+    }
+    bool operator==(const Seq& b) const {
+        return fastMemoryComparisonEqual<N * sizeof(Elem)>((void*)elems, (void*)b.elems);
+    }
+};
+
+// Sequences of at most this many vertices are contracted and ranked by
+// kernels specialized for their exact length. The loops of the kernels are
+// fully unrolled, which makes them branch-free and turns the divisions by the
+// factorials into multiplications. The kernel for the length is picked from a
+// table when the Contractor or the codec is constructed.
+const int MaxExactKernelSize = 16;
+
+template <int N>
+constexpr int exactKernelCount() {
+    return min(N, MaxExactKernelSize) + 1;
+}
+
+// k! for k <= 20
+constexpr uint64_t smallFactorial(int k) {
+    return k <= 1 ? 1 : k * smallFactorial(k - 1);
+}
+
+// Keys that store the lexicographic rank of the sequence, which is always a
+// permutation of the output vertices, in the high bits of a 64-bit integer
+// and the set of lost predecessors in the low N bits. For N <= 16, 16! 2^16 <
+// 2^62, so the keys take 8 bytes instead of the N + 8 bytes of the pair and
+// compare as integers.
+template <int N>
+struct RankedStateCodec {
+    static_assert(N <= MaxExactKernelSize, "The ranked keys of longer sequences do not fit in 64 bits");
+    
+    typedef BP<N> B;
+    typedef uint64_t Key;
+    
+    static const uint64_t LostPredMask = ((uint64_t)1 << N) - 1;
+    
+    explicit RankedStateCodec(int length)
+        : length(length),
+          rank_(rankKernel_(length, make_index_sequence<exactKernelCount<N>()>())),
+          seq_(seqKernel_(length, make_index_sequence<exactKernelCount<N>()>()))
+    {
+        assert(length >= 0 && length <= N);
+    }
+    
+    int length;
+    
+    Key first(const Seq<N>& seq) const {
+        return rank_(seq) << N;
+    }
+    Key last(const Seq<N>& seq) const {
+        return first(seq) | LostPredMask;
+    }
+    
+    Key withLostPred(Key first, B lostPred) const {
+        return first | lostPred.word(0);
+    }
+    
+    Seq<N> seq(Key key) const {
+        return seq_(key >> N);
+    }
+    B lostPred(Key key) const {
+        B ret;
+        ret.setWord(0, key & LostPredMask);
+        return ret;
+    }
+    bool sameSeq(Key a, Key b) const {
+        return (a >> N) == (b >> N);
+    }
+    
+private:
+    uint64_t (*rank_)(const Seq<N>&);
+    Seq<N> (*seq_)(uint64_t);
+    
+    // The Lehmer code of the permutation of length K as a number in the
+    // factorial number system, which orders the permutations
+    // lexicographically
+    template <int K>
+    static uint64_t rankExact_(const Seq<N>& seq) {
+        uint64_t ret = 0;
+        uint32_t remaining = ((uint32_t)1 << K) - 1;
+        for(int i = 0; i < K; ++i) {
+            int x = seq[i];
+            assert(remaining & ((uint32_t)1 << x));
+            ret += __builtin_popcount(remaining & (((uint32_t)1 << x) - 1)) * smallFactorial(K - 1 - i);
+            remaining ^= (uint32_t)1 << x;
+        }
+        return ret;
+    }
+    
+    // The permutation of length K with the given rank. Each digit of the
+    // Lehmer code selects the digit:th remaining element, which pdep finds
+    // without scanning.
+    template <int K>
+    static Seq<N> seqExact_(uint64_t rank) {
+        Seq<N> ret;
+        uint32_t remaining = ((uint32_t)1 << K) - 1;
+        for(int i = 0; i < K; ++i) {
+            uint64_t weight = smallFactorial(K - 1 - i);
+            uint64_t digit = rank / weight;
+            rank -= digit * weight;
+            int x = __builtin_ctz(_pdep_u32((uint32_t)1 << digit, remaining));
+            ret[i] = x;
+            remaining ^= (uint32_t)1 << x;
+        }
+        return ret;
+    }
+    
+    template <size_t... K>
+    static uint64_t (*rankKernel_(int length, index_sequence<K...>))(const Seq<N>&) {
+        static uint64_t (*const kernels[])(const Seq<N>&) = {&rankExact_<K>...};
+        return kernels[length];
+    }
+    template <size_t... K>
+    static Seq<N> (*seqKernel_(int length, index_sequence<K...>))(uint64_t) {
+        static Seq<N> (*const kernels[])(uint64_t) = {&seqExact_<K>...};
+        return kernels[length];
+    }
+};
+
+
+// Restricts sequences of the srcSize vertices of a merge node to the vertices
+// in mask, renumbering them in the order of mask. The result also tells which
+// positions of the sequence were kept and which of the kept positions follow
+// a removed one, that is, lose their predecessor.
+template <int N>
+struct Contractor {
+    typedef BP<N> B;
+    
+    Contractor(int srcSize, B mask)
+        : srcSize(srcSize),
+          size(mask.count()),
+          mask(mask),
+          vertexMap()
+    {
+        assert(srcSize <= N);
+        assert(isSubset(mask, B::range(srcSize)));
+        int pos = 0;
+        mask.iterate([&](int j) {
+            vertexMap[j] = pos++;
+        });
+        selectKernel_();
+    }
+    
+    // The output positions in each set of symmetries are all mapped to the
+    // first position of the set.
+    Contractor(int srcSize, B mask, const vector<B>& symmetries)
+        : srcSize(srcSize),
+          size(mask.count()),
+          mask(mask),
+          vertexMap()
+    {
+        assert(srcSize <= N);
+        assert(isSubset(mask, B::range(srcSize)));
+        int pos = 0;
+        
+        // Positions in no set of symmetries map to themselves
+        int symMap[N];
+        for(int x = 0; x < size; ++x) {
+            symMap[x] = x;
+        }
+        for(B s : symmetries) {
+            int v = s.min();
+            s.iterate([&](int x) {
+                symMap[x] = v;
+            });
+        }
+        
+        mask.iterate([&](int j) {
+            vertexMap[j] = symMap[pos++];
+        });
+        selectKernel_();
+    }
+    
+    int srcSize;
+    int size;
+    B mask;
+    typename Seq<N>::Elem vertexMap[N];
+    
+    struct Result {
+        Seq<N> seq;
+        B origLostPred;
+        B chosenMask;
+    };
+    
+    typedef Result (*Kernel)(const Contractor&, const Seq<N>&);
+    
+    Result operator()(const Seq<N>& seq) const {
+        return kernel_(*this, seq);
+    }
+    
+    // Contraction of a sequence of any length, element by element.
+    static Result contractGeneric(const Contractor& c, const Seq<N>& seq) {
+        Result ret;
+        
+        bool removed = false;
+        int pos = 0;
+        
+        for(int i = 0; i < c.srcSize; ++i) {
+            int j = seq[i];
+            assert(j >= 0 && j < c.srcSize);
+            if(c.mask.has(j)) {
+                if(removed) {
+                    ret.origLostPred.add(i);
+                }
+                ret.chosenMask.add(i);
+                ret.seq[pos++] = c.vertexMap[j];
+            } else {
+                removed = true;
+            }
+        }
+        
+        assert(pos == c.size);
+        
+        return ret;
+    }
+    
+    // The kernel specialized for sequences of length srcSize, for
+    // srcSize < exactKernelCount<N>(). It is used if the target has no
+    // SIMD kernel.
+    static Kernel exactKernel(int srcSize) {
+        assert(srcSize >= 0 && srcSize < exactKernelCount<N>());
+        return exactKernel_(srcSize, make_index_sequence<exactKernelCount<N>()>());
+    }
+    
+private:
+    Kernel kernel_;
+
+#ifdef __AVX512VBMI2__
+    // vertexMap of the chosen vertices and 0x80 for the others
+    alignas(64) uint8_t simdVertexMap_[64];
+    
+    // Contracts a sequence of byte elements of length at most 64 in a few
+    // vector operations: the elements are looked up in simdVertexMap_ with
+    // vpermb, the sign bits of the results give the chosen positions and
+    // vpcompressb packs the chosen results to the front.
+    static Result contractSIMD_(const Contractor& c, const Seq<N>& seq) {
+        Result ret;
+        
+        __mmask64 inSeq = c.srcSize == 64 ? ~(__mmask64)0 : ((__mmask64)1 << c.srcSize) - 1;
+        __m512i elems = _mm512_maskz_loadu_epi8(inSeq, seq.elems);
+        __m512i mapped = _mm512_maskz_permutexvar_epi8(inSeq, elems, _mm512_load_si512(c.simdVertexMap_));
+        uint64_t chosen = inSeq & ~_mm512_movepi8_mask(mapped);
+        uint64_t removed = inSeq & ~chosen;
+        
+        // The elements after the output stay zero
+        __mmask64 inOutput = N >= 64 ? ~(__mmask64)0 : ((__mmask64)1 << min(N, 63)) - 1;
+        _mm512_mask_storeu_epi8(ret.seq.elems, inOutput, _mm512_maskz_compress_epi8(chosen, mapped));
+        
+        // The chosen positions after the first removed one lost their
+        // predecessor
+        ret.chosenMask.setWord(0, chosen);
+        ret.origLostPred.setWord(0, chosen & -removed);
+        
+        assert(__builtin_popcountll(chosen) == c.size);
+        
+        return ret;
+    }
+#endif
+    
+    void selectKernel_() {
+#ifdef __AVX512VBMI2__
+        if constexpr(is_same<typename Seq<N>::Elem, uint8_t>::value) {
+            if(srcSize <= 64) {
+                for(int j = 0; j < 64; ++j) {
+                    simdVertexMap_[j] = j < srcSize && mask.has(j) ? vertexMap[j] : 0x80;
+                }
+                kernel_ = &contractSIMD_;
+                return;
+            }
+        }
+#endif
+        if(srcSize < exactKernelCount<N>()) {
+            kernel_ = exactKernel(srcSize);
+        } else {
+            kernel_ = &contractGeneric;
+        }
+    }
+    
+    // Branch-free contraction of a sequence of length K. Every element is
+    // written to the next output position, which only advances past the
+    // chosen ones.
+    template <int K>
+    static Result contractExact_(const Contractor& c, const Seq<N>& seq) {
+        Result ret;
+        
+        uint64_t mask = c.mask.word(0);
+        uint64_t chosen = 0;
+        uint64_t lost = 0;
+        uint64_t removed = 0;
+        int pos = 0;
+        
+        for(int i = 0; i < K; ++i) {
+            int j = seq[i];
+            assert(j >= 0 && j < K);
+            uint64_t has = (mask >> j) & 1;
+            chosen |= has << i;
+            lost |= (has & removed) << i;
+            removed |= has ^ 1;
+            ret.seq[pos] = c.vertexMap[j];
+            pos += has;
+        }
+        
+        assert(pos == c.size);
+        
+        // The element after the output may have been written by a removed
+        // element
+        if(pos < N) {
+            ret.seq[pos] = 0;
+        }
+        ret.chosenMask.setWord(0, chosen);
+        ret.origLostPred.setWord(0, lost);
+        
+        return ret;
+    }
+    
+    template <size_t... K>
+    static Kernel exactKernel_(int srcSize, index_sequence<K...>) {
+        static const Kernel kernels[] = {&contractExact_<K>...};
+        return kernels[srcSize];
+    }
+};
+
+}
@@ -0,0 +1,651 @@
+#pragma once
+
+#include "mao.hpp"
+#include "mao/treedecomp.hpp"
+
+#include <deque>
+#include <optional>
+
+// The distributions of the states of the tree decomposition DP in
+// mao/treedecomp.cpp and the combine step that joins them.
+namespace treedecomp {
+
+// The states of the DP are pairs of a sequence of the output vertices and the
+// set of positions in the sequence whose predecessor has been lost. A
+// StateCodec for the number of output vertices converts between the pairs and
+// the keys of a Dist, which are ordered first by the sequence and then by the
+// set of lost predecessors.
+
+// Keys that store the pair as is.
+template <int N>
+struct PlainStateCodec {
+    typedef BP<N> B;
+    typedef pair<Seq<N>, B> Key;
+    
+    explicit PlainStateCodec(int) { }
+    
+    // The first and last keys with the given sequence
+    Key first(const Seq<N>& seq) const {
+        return {seq, B()};
+    }
+    Key last(const Seq<N>& seq) const {
+        return {seq, B::ones()};
+    }
+    
+    // The key with the same sequence as first(seq) and the given lostPred
+    Key withLostPred(const Key& first, B lostPred) const {
+        return {first.first, lostPred};
+    }
+    
+    const Seq<N>& seq(const Key& key) const {
+        return key.first;
+    }
+    B lostPred(const Key& key) const {
+        return key.second;
+    }
+    bool sameSeq(const Key& a, const Key& b) const {
+        return a.first == b.first;
+    }
+};
+
+// The ranked keys are used whenever they fit.
+const int MaxRankedVertCount = 16;
+
+template <int N>
+using StateCodec = typename conditional<
+    N <= MaxRankedVertCount,
+    RankedStateCodec<min(N, MaxRankedVertCount)>,
+    PlainStateCodec<N>
+>::type;
+
+template <int N>
+using StateKey = typename StateCodec<N>::Key;
+
+template <int N>
+using Dist = map<StateKey<N>, Z, less<StateKey<N>>, ArenaAllocator<pair<const StateKey<N>, Z>>>;
+
+// Output of a leaf of the merge tree with a output vertices and b extra
+// vertices. Every ordering of the output vertices appears with the same a + 1
+// sets of lost predecessors and counts, so the a! (a + 1) states are not
+// materialized; combine generates them on demand instead.
+template <int N>
+struct LeafDist {
+    typedef BP<N> B;
+    
+    LeafDist(int outputCount, int extraCount) : outputCount(outputCount) {
+        int a = outputCount;
+        int b = extraCount;
+        int n = a + b;
+        assert(outputCount <= N);
+        
+        if(b == 0) {
+            states.emplace_back(B(), 1);
+        } else {
+            // If the first output vertex after the extra vertices is i, the
+            // number of orderings of the extra vertices is
+            // b (n - i - 1)^(b - 1) where ^ denotes the falling factorial
+            states.resize(a + 1);
+            states[a] = make_pair(B(), factorial(b));
+            for(int i = a - 1; i >= 0; --i) {
+                states[i] = make_pair(
+                    states[i + 1].first.with(i),
+                    b * fallingFactorial(n - i - 1, b - 1)
+                );
+            }
+        }
+    }
+    
+    int outputCount;
+    
+    // The sets of lost predecessors and counts shared by all orderings
+    vector<pair<B, Z>> states;
+    
+    // The number of states, saturated to UINT64_MAX
+    uint64_t size() const {
+        uint64_t ret = states.size();
+        for(int i = 2; i <= outputCount; ++i) {
+            if(ret > UINT64_MAX / i) {
+                return UINT64_MAX;
+            }
+            ret *= i;
+        }
+        return ret;
+    }
+    
+    Z total() const {
+        Z ret = 0;
+        for(const pair<B, Z>& state : states) {
+            ret += state.second;
+        }
+        return ret * factorial(outputCount);
+    }
+};
+
+// Output of a merge node with k output vertices that stores the counts of all
+// the k! 2^k states in an array, indexed by the rank of the sequence as in
+// RankedStateCodec and the set of lost predecessors. It has no per-state
+// overhead, so it is used instead of a Dist when most of the states are
+// predicted to be reached. Only used with the ranked keys.
+template <int N>
+struct DenseDist {
+    explicit DenseDist(int length)
+        : length(length),
+          stateCount(0),
+          counts(factorial(length).get_ui() << length)
+    { }
+    
+    int length;
+    
+    // The number of nonzero counts
+    uint64_t stateCount;
+    
+    vector<Z> counts;
+    
+    uint64_t size() const {
+        return stateCount;
+    }
+    
+    // Conversions between the ranked keys and the indices of counts
+    size_t index(uint64_t key) const {
+        return (size_t)(key >> N) << length | (key & (((uint64_t)1 << N) - 1));
+    }
+    uint64_t key(size_t index) const {
+        return (uint64_t)(index >> length) << N | (index & (((size_t)1 << length) - 1));
+    }
+    
+    Z total() const {
+        Z ret = 0;
+        for(const Z& count : counts) {
+            ret += count;
+        }
+        return ret;
+    }
+};
+
+template <int N>
+Dist<N> sparseDist(const DenseDist<N>& dense) {
+    Dist<N> ret;
+    for(size_t i = 0; i < dense.counts.size(); ++i) {
+        if(sgn(dense.counts[i])) {
+            ret.emplace_hint(ret.end(), dense.key(i), dense.counts[i]);
+        }
+    }
+    return ret;
+}
+
+// Output of a subtree of the merge tree. Dense outputs are only possible with
+// the ranked keys.
+template <int N>
+using SubtreeDist = typename conditional<
+    N <= MaxRankedVertCount,
+    variant<Dist<N>, LeafDist<N>, DenseDist<N>>,
+    variant<Dist<N>, LeafDist<N>>
+>::type;
+
+template <int N>
+uint64_t distSize(const SubtreeDist<N>& dist) {
+    return visit([&](const auto& d) { return (uint64_t)d.size(); }, dist);
+}
+
+// The states of a distribution of type D with the same sequence. Calling it
+// with g calls g(lostPred, count) for each of the states.
+template <int N, typename D>
+struct SeqGroupStates {
+    typedef typename Dist<N>::const_iterator Iterator;
+    
+    const StateCodec<N>* codec;
+    Iterator begin;
+    Iterator end;
+    
+    size_t size() const {
+        return distance(begin, end);
+    }
+    bool operator==(const SeqGroupStates& other) const {
+        return begin == other.begin && end == other.end;
+    }
+    
+    template <typename G>
+    void operator()(G g) const {
+        for(Iterator state = begin; state != end; ++state) {
+            g(codec->lostPred(state->first), state->second);
+        }
+    }
+};
+template <int N>
+struct SeqGroupStates<N, LeafDist<N>> {
+    const LeafDist<N>* dist;
+    
+    size_t size() const {
+        return dist->states.size();
+    }
+    bool operator==(const SeqGroupStates& other) const {
+        return dist == other.dist;
+    }
+    
+    template <typename G>
+    void operator()(G g) const {
+        for(const pair<BP<N>, Z>& state : dist->states) {
+            g(state.first, state.second);
+        }
+    }
+};
+
+template <int N>
+struct SeqGroupStates<N, DenseDist<N>> {
+    // The 2^length counts of the sets of lost predecessors
+    const Z* counts;
+    int length;
+    
+    size_t size() const {
+        size_t ret = 0;
+        for(uint64_t m = 0; m < ((uint64_t)1 << length); ++m) {
+            ret += sgn(counts[m]) != 0;
+        }
+        return ret;
+    }
+    bool operator==(const SeqGroupStates& other) const {
+        return counts == other.counts;
+    }
+    
+    template <typename G>
+    void operator()(G g) const {
+        for(uint64_t m = 0; m < ((uint64_t)1 << length); ++m) {
+            if(sgn(counts[m])) {
+                BP<N> lostPred;
+                lostPred.setWord(0, m);
+                g(lostPred, counts[m]);
+            }
+        }
+    }
+};
+
+// Calls f(seq, states) for each sequence of the states of dist in increasing
+// order, where states is the SeqGroupStates of the states with that sequence.
+// The codec must be the one for the length of the sequences of dist.
+template <int N, typename F>
+void forEachSeqGroup(const Dist<N>& dist, const StateCodec<N>& codec, F f) {
+    auto it = dist.begin();
+    while(it != dist.end()) {
+        auto groupEnd = next(it);
+        while(groupEnd != dist.end() && codec.sameSeq(groupEnd->first, it->first)) {
+            ++groupEnd;
+        }
+        f(codec.seq(it->first), SeqGroupStates<N, Dist<N>>{&codec, it, groupEnd});
+        it = groupEnd;
+    }
+}
+template <int N, typename F>
+void forEachSeqGroup(const LeafDist<N>& dist, const StateCodec<N>&, F f) {
+    int length = dist.outputCount;
+    Seq<N> seq;
+    for(int i = 0; i < length; ++i) {
+        seq[i] = i;
+    }
+    do {
+        pollCancellation();
+        f(seq, SeqGroupStates<N, LeafDist<N>>{&dist});
+    } while(next_permutation(seq.elems, seq.elems + length));
+}
+
+template <int N, typename F>
+void forEachSeqGroup(const DenseDist<N>& dist, const StateCodec<N>& codec, F f) {
+    size_t groupSize = (size_t)1 << dist.length;
+    for(size_t i = 0; i < dist.counts.size(); i += groupSize) {
+        pollCancellation();
+        SeqGroupStates<N, DenseDist<N>> states{&dist.counts[i], dist.length};
+        if(states.size() != 0) {
+            f(codec.seq(dist.key(i)), states);
+        }
+    }
+}
+
+// Calls f(seq, aStates, bStates) for each sequence group of a, where bStates
+// are the states of b whose sequence is bSeq(seq). The sequence groups of a
+// are sorted by the key of their group in b, so that b is scanned in order
+// once instead of being searched for every group of a.
+template <int N, typename ADist, typename BSeqF, typename F>
+void joinSeqGroups(
+    const ADist& a,
+    const StateCodec<N>& aCodec,
+    const Dist<N>& b,
+    const StateCodec<N>& bCodec,
+    BSeqF bSeq,
+    F f
+) {
+    struct Entry {
+        StateKey<N> bFirst;
+        Seq<N> seq;
+        SeqGroupStates<N, ADist> states;
+    };
+    vector<Entry> entries;
+    forEachSeqGroup<N>(a, aCodec, [&](const Seq<N>& seq, SeqGroupStates<N, ADist> states) {
+        entries.push_back({bCodec.first(bSeq(seq)), seq, states});
+    });
+    sort(entries.begin(), entries.end(), [&](const Entry& x, const Entry& y) {
+        return x.bFirst < y.bFirst;
+    });
+    
+    auto bIt = b.begin();
+    auto entry = entries.begin();
+    while(entry != entries.end()) {
+        // All the entries with the same key join with the same group of b
+        StateKey<N> bFirst = entry->bFirst;
+        while(bIt != b.end() && bIt->first < bFirst) {
+            ++bIt;
+        }
+        auto bGroupEnd = bIt;
+        while(bGroupEnd != b.end() && bCodec.sameSeq(bGroupEnd->first, bFirst)) {
+            ++bGroupEnd;
+        }
+        SeqGroupStates<N, Dist<N>> bStates{&bCodec, bIt, bGroupEnd};
+        for(; entry != entries.end() && entry->bFirst == bFirst; ++entry) {
+            f(entry->seq, entry->states, bStates);
+        }
+        bIt = bGroupEnd;
+    }
+}
+
+// The states of a leaf do not depend on the sequence, so no join is needed.
+template <int N, typename ADist, typename BSeqF, typename F>
+void joinSeqGroups(
+    const ADist& a,
+    const StateCodec<N>& aCodec,
+    const LeafDist<N>& b,
+    const StateCodec<N>&,
+    BSeqF,
+    F f
+) {
+    forEachSeqGroup<N>(a, aCodec, [&](const Seq<N>& seq, SeqGroupStates<N, ADist> states) {
+        f(seq, states, SeqGroupStates<N, LeafDist<N>>{&b});
+    });
+}
+
+// The group of a dense distribution is found by its index.
+template <int N, typename ADist, typename BSeqF, typename F>
+void joinSeqGroups(
+    const ADist& a,
+    const StateCodec<N>& aCodec,
+    const DenseDist<N>& b,
+    const StateCodec<N>& bCodec,
+    BSeqF bSeq,
+    F f
+) {
+    forEachSeqGroup<N>(a, aCodec, [&](const Seq<N>& seq, SeqGroupStates<N, ADist> states) {
+        size_t index = b.index(bCodec.first(bSeq(seq)));
+        f(seq, states, SeqGroupStates<N, DenseDist<N>>{&b.counts[index], b.length});
+    });
+}
+
+// The subset convolution is used over at most this many positions.
+const int MaxSubsetConvolutionSize = 12;
+
+// Factor applied to the estimated cost of the subset convolution of a
+// sequence group before comparing it to the number of pairs of states.
+const double SubsetConvolutionCostFactor = 1.0;
+
+// Whether the subset convolution may be cheaper than going through the pairs
+// of states of sequence groups of the given sizes. The sets of lost
+// predecessors in a group are distinct, so there are at least log2 of the
+// size of the larger group positions. This rules out most groups without
+// going through their states.
+inline bool subsetConvolutionMayPay(size_t aSize, size_t bSize) {
+    size_t smaller = min(aSize, bSize);
+    int minK = ceilLog2((int)max(max(aSize, bSize), (size_t)1));
+    return minK <= MaxSubsetConvolutionSize && smaller > SubsetConvolutionCostFactor * (minK + 1) * (minK + 1);
+}
+
+// Combines the states of a sequence group by subset convolution over the
+// positions that appear in their sets of lost predecessors, calling
+// f(lostPred, count) for every union lostPred of disjoint sets of a and b with
+// the sum of the products of the counts of the pairs. The states of b are
+// given as arrays of the packed sets and the counts. The convolution takes
+// O(2^k k^2) operations for k positions, so it is only used if that, scaled by
+// costFactor, is less than the number of pairs; otherwise returns false
+// without calling f.
+template <int N, typename AStates, typename F>
+bool convolveSeqGroup(
+    const AStates& forEachAState,
+    const vector<BP<N>>& bPackedLostPreds,
+    const vector<const Z*>& bCounts,
+    const typename Contractor<N>::Result& bContraction,
+    double costFactor,
+    F f
+) {
+    typedef BP<N> B;
+    
+    B positions;
+    vector<pair<B, const Z*>> bStates;
+    for(size_t j = 0; j < bPackedLostPreds.size(); ++j) {
+        // The states that lost a predecessor removed by the contraction do
+        // not match any state of a
+        B lostPred = B::unpack(bPackedLostPreds[j], bContraction.chosenMask);
+        if(setIntersection(lostPred, bContraction.origLostPred).isEmpty()) {
+            bStates.emplace_back(lostPred, bCounts[j]);
+            positions = setUnion(positions, lostPred);
+        }
+    }
+    vector<pair<B, const Z*>> aStates;
+    forEachAState([&](B lostPred, const Z& count) {
+        aStates.emplace_back(lostPred, &count);
+        positions = setUnion(positions, lostPred);
+    });
+    
+    int k = positions.count();
+    uint64_t pairCount = (uint64_t)aStates.size() * bStates.size();
+    if(k > MaxSubsetConvolutionSize || pairCount <= costFactor * ((uint64_t)(k + 1) * (k + 1) << k)) {
+        return false;
+    }
+    
+    size_t n = (size_t)1 << k;
+    vector<Z> aConvCounts(n);
+    for(const pair<B, const Z*>& state : aStates) {
+        aConvCounts[B::pack(state.first, positions).word(0)] = *state.second;
+    }
+    vector<Z> bConvCounts(n);
+    for(const pair<B, const Z*>& state : bStates) {
+        bConvCounts[B::pack(state.first, positions).word(0)] = *state.second;
+    }
+    
+    vector<Z> counts = subsetConvolution(aConvCounts, bConvCounts, k);
+    for(size_t s = 0; s < n; ++s) {
+        if(counts[s] != 0) {
+            B packed;
+            packed.setWord(0, s);
+            f(B::unpack(packed, positions), move(counts[s]));
+        }
+    }
+    return true;
+}
+
+// Accepted pairs of states are buffered and added to the output in the order
+// of their keys, as adding them in the order of the join would access the
+// output map randomly.
+const size_t ProductBufferSize = (size_t)1 << 20;
+
+// Combines the outputs a and b of the children of a merge node. The output is
+// stored densely if dense is set, which requires the ranked keys.
+template <int N, typename ADist, typename BDist>
+SubtreeDist<N> combine(
+    const ADist& a,
+    const BDist& b,
+    int vertCount,
+    BP<N> bMask,
+    BP<N> outputMask,
+    bool dense,
+    CombineCounts& counts
+) {
+    typedef BP<N> B;
+    
+    Dist<N> dist;
+    optional<DenseDist<N>> denseDist;
+    if(dense) {
+        denseDist.emplace(outputMask.count());
+    }
+    
+    Contractor<N> bContractor(vertCount, bMask);
+    Contractor<N> outputContractor(vertCount, outputMask);
+    
+    StateCodec<N> aCodec(vertCount);
+    StateCodec<N> bCodec(bMask.count());
+    StateCodec<N> outputCodec(outputMask.count());
+    
+    struct Product {
+        StateKey<N> key;
+        const Z* aCount;
+        const Z* bCount;
+    };
+    vector<Product> products;
+    if(!dense) {
+        products.reserve(ProductBufferSize);
+    }
+    
+    // The sums computed by subset convolution are buffered as products with 1
+    deque<Z> convolvedCounts;
+    static const Z one = 1;
+    
+    auto flush = [&]() {
+        sort(products.begin(), products.end(), [&](const Product& x, const Product& y) {
+            return x.key < y.key;
+        });
+        for(size_t i = 0; i < products.size(); ) {
+            const StateKey<N>& key = products[i].key;
+            // Keys past the end of the map, such as all keys of the first
+            // flush, are appended without a search
+            auto it = dist.end();
+            if(!dist.empty() && !(prev(dist.end())->first < key)) {
+                it = dist.lower_bound(key);
+            }
+            if(it == dist.end() || key < it->first) {
+                it = dist.emplace_hint(it, key, 0);
+            }
+            for(; i < products.size() && products[i].key == key; ++i) {
+                addProduct(it->second, *products[i].aCount, *products[i].bCount);
+            }
+        }
+        products.clear();
+        convolvedCounts.clear();
+    };
+    
+    // Adds x y to the count of the output state key
+    auto emit = [&](const StateKey<N>& key, const Z& x, const Z& y) {
+        ++counts.accepted;
+        if constexpr(N <= MaxRankedVertCount) {
+            if(dense) {
+                addProduct(denseDist->counts[denseDist->index(key)], x, y);
+                return;
+            }
+        }
+        products.push_back({key, &x, &y});
+        if(products.size() == ProductBufferSize) {
+            flush();
+        }
+    };
+    
+    optional<SeqGroupStates<N, BDist>> bGroup;
+    vector<B> bPackedLostPreds;
+    vector<const Z*> bCounts;
+    
+    auto bSeq = [&](const Seq<N>& seq) {
+        return bContractor(seq).seq;
+    };
+    joinSeqGroups<N>(a, aCodec, b, bCodec, bSeq, [&](const Seq<N>& seq, const auto& forEachAState, const auto& forEachBState) {
+        typename Contractor<N>::Result bContraction = bContractor(seq);
+        typename Contractor<N>::Result outputContraction = outputContractor(seq);
+        StateKey<N> outputFirst = outputCodec.first(outputContraction.seq);
+        
+        auto emitPair = [&](B aLostPred, B bPackedLostPred, const Z& aCount, const Z& bCount) {
+            B lostPred = setUnion(
+                setUnion(aLostPred, B::unpack(bPackedLostPred, bContraction.chosenMask)),
+                outputContraction.origLostPred
+            );
+            lostPred = B::pack(lostPred, outputContraction.chosenMask);
+            emit(outputCodec.withLostPred(outputFirst, lostPred), aCount, bCount);
+        };
+        
+        if constexpr(is_same<BDist, DenseDist<N>>::value) {
+            // The sets of b that avoid the excluded positions are the subsets
+            // of the rest, which are enumerated directly
+            uint64_t all = ((uint64_t)1 << forEachBState.length) - 1;
+            forEachAState([&](B aLostPred, const Z& aCount) {
+                pollCancellation();
+                B excluded = B::pack(
+                    setUnion(aLostPred, bContraction.origLostPred),
+                    bContraction.chosenMask
+                );
+                uint64_t allowed = all & ~excluded.word(0);
+                for(uint64_t m = allowed; ; m = (m - 1) & allowed) {
+                    ++counts.examined;
+                    const Z& bCount = forEachBState.counts[m];
+                    if(sgn(bCount)) {
+                        B bPackedLostPred;
+                        bPackedLostPred.setWord(0, m);
+                        emitPair(aLostPred, bPackedLostPred, aCount, bCount);
+                    }
+                    if(m == 0) {
+                        break;
+                    }
+                }
+            });
+            return;
+        }
+        
+        // Consecutive groups of a often join with the same group of b, whose
+        // states are then tested from the same arrays
+        if(!bGroup || !(*bGroup == forEachBState)) {
+            bGroup = forEachBState;
+            bPackedLostPreds.clear();
+            bCounts.clear();
+            forEachBState([&](B bPackedLostPred, const Z& bCount) {
+                bPackedLostPreds.push_back(bPackedLostPred);
+                bCounts.push_back(&bCount);
+            });
+        }
+        
+        size_t aSize = forEachAState.size();
+        size_t bSize = bPackedLostPreds.size();
+        if(subsetConvolutionMayPay(aSize, bSize) && convolveSeqGroup<N>(
+            forEachAState, bPackedLostPreds, bCounts, bContraction, SubsetConvolutionCostFactor,
+            [&](B lostPred, Z count) {
+                lostPred = B::pack(
+                    setUnion(lostPred, outputContraction.origLostPred),
+                    outputContraction.chosenMask
+                );
+                convolvedCounts.push_back(move(count));
+                emit(outputCodec.withLostPred(outputFirst, lostPred), convolvedCounts.back(), one);
+            }
+        )) {
+            counts.examined += (uint64_t)aSize * bSize;
+            ++counts.convolvedGroups;
+            pollCancellation();
+            return;
+        }
+        
+        forEachAState([&](B aLostPred, const Z& aCount) {
+            counts.examined += bSize;
+            pollCancellation();
+            // The states of b that lost a predecessor in aLostPred or removed
+            // by the contraction are those whose packed set meets the packed
+            // union, so the sets of b are only unpacked for the matches
+            B excluded = B::pack(
+                setUnion(aLostPred, bContraction.origLostPred),
+                bContraction.chosenMask
+            );
+            B::forEachDisjoint(bPackedLostPreds.data(), bSize, excluded, [&](size_t j) {
+                emitPair(aLostPred, bPackedLostPreds[j], aCount, *bCounts[j]);
+            });
+        });
+    });
+    
+    if constexpr(N <= MaxRankedVertCount) {
+        if(dense) {
+            for(const Z& count : denseDist->counts) {
+                denseDist->stateCount += sgn(count) != 0;
+            }
+            return move(*denseDist);
+        }
+    }
+    flush();
+    return dist;
+}
+
+}
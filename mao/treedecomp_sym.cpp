@@ -1,5 +1,6 @@
 #include "mao.hpp"
 #include "full_binary_tree.hpp"
+#include "mao/treedecomp.hpp"
 
 #include <deque>
 #include <cstdlib>
@@ -7,8 +8,7 @@
 
 namespace {
 
-template <int N>
-using BP = BitSet<bitSetParam(N)>;
+using namespace treedecomp;
 
 // Pre-Merge Tree, phase 1: The tree where leaves are the cliques in the graph and inner nodes specify the order in which they are merged
 template <int N>
@@ -177,7 +177,7 @@ pair<PreMergeTree3<N>, vector<BP<N>>> createPreMergeTree3_(const PreMergeTree2<N
                     outputSymmetries.push_back(s);
                 } else {
                     assert(setIntersection(s, node.outputVerts).isEmpty());
-                    node.symmetryMultiplier *= FactorialTable<N>::get(s.count());
+                    node.symmetryMultiplier *= factorial(s.count());
                 }
             }
             
@@ -312,110 +312,11 @@ int maxVertCount(const MergeTree<N>& mergeTree) {
     );
 }
 
-template <int N>
-struct Seq {
-    typedef typename conditional<N <= 256, uint8_t, int>::type Elem;
-    Elem elems[N];
-    
-    Seq() : elems() { }
-    
-    const Elem& operator[](int i) const {
-        return elems[i];
-    }
-    Elem& operator[](int i) {
-        return elems[i];
-    }
-    
-    bool operator<(const Seq& b) const {
-        return fastMemoryComparisonLess<N * sizeof(Elem)>((void*)elems, (void*)b.elems);
-    }
-    bool operator==(const Seq& b) const {
-        return fastMemoryComparisonEqual<N * sizeof(Elem)>((void*)elems, (void*)b.elems);
-    }
-};
-
 template <int N>
 using State = pair<Seq<N>, BP<N>>;
 
 template <int N>
-using Dist = map<State<N>, Z, less<State<N>>, PoolAllocator<pair<const State<N>, Z>>>;
-
-template <int N>
-struct Contractor {
-    typedef BP<N> B;
-    
-    Contractor(int srcSize, B mask)
-        : srcSize(srcSize),
-          size(mask.count()),
-          mask(mask)
-    {
-        assert(srcSize <= N);
-        assert(isSubset(mask, B::range(srcSize)));
-        int pos = 0;
-        
-        mask.iterate([&](int j) {
-            vertexMap[j] = pos++;
-        });
-    }
-    
-    Contractor(int srcSize, B mask, const vector<B>& symmetries)
-        : srcSize(srcSize),
-          size(mask.count()),
-          mask(mask)
-    {
-        assert(srcSize <= N);
-        assert(isSubset(mask, B::range(srcSize)));
-        int pos = 0;
-        
-        int symMap[N];
-        for(B s : symmetries) {
-            int v = s.min();
-            s.iterate([&](int x) {
-                symMap[x] = v;
-            });
-        }
-        
-        mask.iterate([&](int j) {
-            vertexMap[j] = symMap[pos++];
-        });
-    }
-    
-    int srcSize;
-    int size;
-    B mask;
-    typename Seq<N>::Elem vertexMap[N];
-    
-    struct Result {
-        Seq<N> seq;
-        B origLostPred;
-        B chosenMask;
-    };
-    
-    Result operator()(const Seq<N>& seq) {
-        Result ret;
-        
-        bool removed = false;
-        int pos = 0;
-        
-        for(int i = 0; i < srcSize; ++i) {
-            int j = seq[i];
-            assert(j >= 0 && j < srcSize);
-            if(mask.has(j)) {
-                if(removed) {
-                    ret.origLostPred.add(i);
-                }
-                ret.chosenMask.add(i);
-                ret.seq[pos++] = vertexMap[j];
-            } else {
-                removed = true;
-            }
-        }
-        
-        assert(pos == size);
-        
-        return ret;
-    }
-};
+using Dist = map<State<N>, Z, less<State<N>>, ArenaAllocator<pair<const State<N>, Z>>>;
 
 template <int N>
 struct Expander {
@@ -501,20 +402,20 @@ Dist<N> singletonDist(int outputCount, int extraCount) {
     
     Dist<N> dist;
     
-    Z bFact = 1;
-    for(int i = 2; i <= b; ++i) {
-        bFact *= i;
-    }
+    const Z& bFact = factorial(b);
     
     if(b == 0) {
         dist[{seq, B()}] = bFact;
     } else {
+        // If the first output vertex after the extra vertices is i, the
+        // number of orderings of the extra vertices is b (n - i - 1)^(b - 1)
+        // where ^ denotes the falling factorial
         pair<B, Z> vals[N + 1];
         vals[a] = make_pair(B(), bFact);
         for(int i = a - 1; i >= 0; --i) {
             vals[i] = make_pair(
                 vals[i + 1].first.with(i),
-                vals[i + 1].second * (n - i - 1) / (a - i)
+                b * fallingFactorial(n - i - 1, b - 1)
             );
         }
         
@@ -535,7 +436,8 @@ Dist<N> combine(
     BP<N> outputMask,
     const vector<BP<N>>& symmetries,
     const vector<BP<N>>& aSymmetries,
-    const vector<BP<N>>& bSymmetries
+    const vector<BP<N>>& bSymmetries,
+    CombineCounts& counts
 ) {
     typedef BP<N> B;
     
@@ -560,6 +462,8 @@ Dist<N> combine(
             
             for(auto ai = as; ai != ae; ++ai) {
                 for(auto bi = bs; bi != be; ++bi) {
+                    ++counts.examined;
+                    pollCancellation();
                     if(setIntersection(
                         setUnion(ai->first.second, bContraction.origLostPred),
                         B::unpack(bi->first.second, bContraction.chosenMask)
@@ -572,8 +476,8 @@ Dist<N> combine(
                             outputContraction.origLostPred
                         );
                         lostPred = B::pack(lostPred, outputContraction.chosenMask);
-                        Z count = ai->second * bi->second;
-                        dist[{outputContraction.seq, lostPred}] += count;
+                        addProduct(dist[{outputContraction.seq, lostPred}], ai->second, bi->second);
+                        ++counts.accepted;
                     }
                 }
             }
@@ -586,16 +490,30 @@ Dist<N> combine(
 }
 
 template <int N>
-pair<Dist<N>, Z> dpSubtree(const MergeTree<N>& mergeTree) {
+pair<Dist<N>, Z> dpSubtree(const MergeTree<N>& mergeTree, const MergeTreeCheckpoints* checkpoints);
+
+template <int N>
+pair<Dist<N>, Z> evaluateSubtree(const MergeTree<N>& mergeTree, const MergeTreeCheckpoints* checkpoints) {
     return mergeTree.visit(
         [&](const auto& node) {
+            MergeProfiler* profiler = activeMergeProfiler;
+            MergeProfileNode profile;
+            if(profiler) {
+                profile.start = profiler->now();
+            }
+            
             Dist<N> left;
             Z leftMul;
-            tie(left, leftMul) = dpSubtree(node.left);
+            tie(left, leftMul) = dpSubtree(node.left, checkpoints);
+            if(profiler) {
+                profile.left = profiler->lastIndex();
+            }
             Dist<N> right;
             Z rightMul;
-            tie(right, rightMul) = dpSubtree(node.right);
+            tie(right, rightMul) = dpSubtree(node.right, checkpoints);
             
+            double selfStart = profiler ? profiler->now() : 0.0;
+            uint64_t bytesStart = arenaStats.bytesAllocated;
             Dist<N> output = combine(
                 left, right,
                 node.vertCount,
@@ -603,28 +521,141 @@ pair<Dist<N>, Z> dpSubtree(const MergeTree<N>& mergeTree) {
                 node.outputMask,
                 node.symmetries,
                 node.leftSymmetries,
-                node.rightSymmetries
+                node.rightSymmetries,
+                profile.counts
             );
             Z mul = node.symmetryMultiplier * leftMul * rightMul;
+            countMAOStats.recordTable(output.size());
             
-            return make_pair(output, mul);
+            if(profiler) {
+                profile.right = profiler->lastIndex();
+                profile.vertCount = node.vertCount;
+                profile.leftSize = left.size();
+                profile.rightSize = right.size();
+                profile.outputSize = output.size();
+                profile.bytesAllocated = arenaStats.bytesAllocated - bytesStart;
+                profile.end = profiler->now();
+                profile.selfSeconds = profile.end - selfStart;
+                profiler->add(profile);
+            }
+            
+            return make_pair(move(output), mul);
         },
         [&](const auto& leaf) {
-            return make_pair(
-                singletonDist<N>(leaf.outputCount, leaf.extraCount),
-                (Z)1
-            );
+            MergeProfiler* profiler = activeMergeProfiler;
+            double start = profiler ? profiler->now() : 0.0;
+            uint64_t bytesStart = arenaStats.bytesAllocated;
+            Dist<N> dist = singletonDist<N>(leaf.outputCount, leaf.extraCount);
+            countMAOStats.recordTable(dist.size());
+            
+            if(profiler) {
+                MergeProfileNode profile;
+                profile.vertCount = leaf.outputCount + leaf.extraCount;
+                profile.outputSize = dist.size();
+                profile.bytesAllocated = arenaStats.bytesAllocated - bytesStart;
+                profile.start = start;
+                profile.end = profiler->now();
+                profile.selfSeconds = profile.end - start;
+                profiler->add(profile);
+            }
+            return make_pair(move(dist), (Z)1);
         }
     );
 }
 
+template <int N>
+int subtreeOutputCount(const MergeTree<N>& mergeTree) {
+    return mergeTree.visit(
+        [&](const auto& node) {
+            return node.outputMask.count();
+        },
+        [&](const auto& leaf) {
+            return leaf.outputCount;
+        }
+    );
+}
+
+// Evaluates the subtree, or loads its output and symmetry multiplier from a
+// checkpoint saved by an earlier run. Once the output of a slow subtree has
+// been saved, the checkpoints of its children are no longer needed.
+template <int N>
+pair<Dist<N>, Z> dpSubtree(const MergeTree<N>& mergeTree, const MergeTreeCheckpoints* checkpoints) {
+    // The output of a leaf is at most a + 1 states of a single sequence, which
+    // is faster to build than to load, so leaves are never checkpointed
+    if(checkpoints == nullptr || mergeTree.isLeaf()) {
+        return evaluateSubtree(mergeTree, checkpoints);
+    }
+    
+    MergeProfiler* profiler = activeMergeProfiler;
+    double profileStart = profiler ? profiler->now() : 0.0;
+    string path = checkpoints->path(&mergeTree);
+    int outputCount = subtreeOutputCount(mergeTree);
+    
+    CheckpointReader in(path);
+    if(in.isOpen()) {
+        Dist<N> dist = readCheckpointDist<Dist<N>>(in, outputCount);
+        Z mul = in.readZ();
+        in.finish();
+        checkpoints->dir().recordLoad();
+        countMAOStats.recordTable(dist.size());
+        if(profiler) {
+            MergeProfileNode profile;
+            profile.vertCount = outputCount;
+            profile.outputSize = dist.size();
+            profile.start = profileStart;
+            profile.end = profiler->now();
+            profile.selfSeconds = profile.end - profileStart;
+            profiler->add(profile);
+        }
+        return make_pair(move(dist), mul);
+    }
+    
+    auto start = chrono::steady_clock::now();
+    pair<Dist<N>, Z> ret = evaluateSubtree(mergeTree, checkpoints);
+    if(chrono::duration<double>(chrono::steady_clock::now() - start).count() >= checkpoints->dir().minSeconds()) {
+        CheckpointWriter out(path);
+        writeCheckpointDist(out, ret.first, outputCount);
+        out.writeZ(ret.second);
+        out.commit();
+        checkpoints->dir().recordSave();
+        mergeTree.visit(
+            [&](const auto& node) {
+                checkpoints->remove(&node.left);
+                checkpoints->remove(&node.right);
+            },
+            [&](const auto&) { }
+        );
+    }
+    return ret;
+}
+
 template <int N, int SrcN>
-Z count(const MergeTree<SrcN>& srcMergeTree) {
+Z count(const MergeTree<SrcN>& srcMergeTree, uint64_t graphHash) {
     MergeTree<N> mergeTree = convertMergeTree<N>(srcMergeTree);
     
+    // The output of a subtree also depends on the symmetries of its nodes
+    unique_ptr<MergeTreeCheckpoints> checkpoints;
+    if(activeDPCheckpoint) {
+        checkpoints = make_unique<MergeTreeCheckpoints>(
+            *activeDPCheckpoint, "tdsym", graphHash, mergeTree,
+            [](uint64_t& h, const MergeNode<N>& node) {
+                for(const vector<BP<N>>* syms : {&node.leftSymmetries, &node.rightSymmetries, &node.symmetries}) {
+                    hashCombine(h, syms->size());
+                    for(const BP<N>& sym : *syms) {
+                        sym.iterate([&](int v) {
+                            hashCombine(h, v);
+                        });
+                        hashCombine(h, -1);
+                    }
+                }
+                hashCombine(h, node.symmetryMultiplier.get_ui());
+            }
+        );
+    }
+    
     Z mul;
     Dist<N> dist;
-    tie(dist, mul) = dpSubtree(mergeTree);
+    tie(dist, mul) = dpSubtree(mergeTree, checkpoints.get());
     
     Z ret = 0;
     for(const pair<State<N>, Z>& p : dist) {
@@ -637,7 +668,7 @@ Z count(const MergeTree<SrcN>& srcMergeTree) {
 }
 
 template <int N>
-Z count(const Graph<N>& graph) {
+Z count(const Graph<N>& graph, uint64_t graphHash) {
     assert(isValidEssentialGraph(graph));
     
     Z ret = 1;
@@ -646,7 +677,7 @@ Z count(const Graph<N>& graph) {
         auto decomp = subgraph.findTreeDecompositionInChordal();
         MergeTree<N> mergeTree = createMergeTree<N>(decomp);
         select2Pow<ceilLog2(N)>(maxVertCount(mergeTree), [&](auto sel) {
-            ret *= count<sel.Val>(mergeTree);
+            ret *= count<sel.Val>(mergeTree, graphHash);
         });
     });
     return ret;
@@ -655,9 +686,11 @@ Z count(const Graph<N>& graph) {
 }
 
 Z countMAOUsingTreeDecompositionDPSymmetryReduction(const GraphData& graphData) {
+    uint64_t graphHash = activeDPCheckpoint ? graphData.hash() : 0;
+    
     Z ret;
     graphData.accessGraph([&](auto graph) {
-        ret = count(graph);
+        ret = count(graph, graphHash);
     });
     return ret;
 }
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <chrono>
+
+// Counts of the pairs of input states considered when merging two
+// distributions in a tree decomposition DP, and of the sequence groups whose
+// pairs were combined by subset convolution instead of one by one.
+struct CombineCounts {
+    uint64_t examined = 0;
+    uint64_t accepted = 0;
+    uint64_t convolvedGroups = 0;
+};
+
+// Profile of one node of the merge tree of a tree decomposition DP. Leaves
+// have no children and no inputs.
+struct MergeProfileNode {
+    int left = -1;
+    int right = -1;
+    int vertCount = 0;
+    uint64_t leftSize = 0;
+    uint64_t rightSize = 0;
+    CombineCounts counts;
+    uint64_t outputSize = 0;
+    uint64_t bytesAllocated = 0;
+    
+    // Start and end of the evaluation of the whole subtree and the time spent
+    // in this node alone, in seconds since the start of profiling
+    double start = 0.0;
+    double end = 0.0;
+    double selfSeconds = 0.0;
+};
+
+// Collects the profiles of the merge tree nodes evaluated by the tree
+// decomposition DP methods while it is installed as activeMergeProfiler.
+// Nodes are added in post-order, so that the children of a node precede it.
+class MergeProfiler {
+public:
+    MergeProfiler() : startTime_(chrono::steady_clock::now()) { }
+    
+    double now() const {
+        return chrono::duration<double>(chrono::steady_clock::now() - startTime_).count();
+    }
+    
+    // Returns the index of the added node.
+    int add(const MergeProfileNode& node) {
+        nodes_.push_back(node);
+        return (int)nodes_.size() - 1;
+    }
+    
+    int lastIndex() const {
+        return (int)nodes_.size() - 1;
+    }
+    
+    const vector<MergeProfileNode>& nodes() const {
+        return nodes_;
+    }
+    
+    // Writes the profile in the Chrome trace event format, with one complete
+    // event spanning the evaluation of each subtree.
+    void writeChromeTrace(ostream& out) const {
+        out << "{\"traceEvents\": [";
+        for(int i = 0; i < (int)nodes_.size(); ++i) {
+            const MergeProfileNode& node = nodes_[i];
+            out << (i ? ",\n" : "\n");
+            out << "  {\"name\": \"" << (node.left == -1 ? "leaf " : "merge ") << i << "\"";
+            out << ", \"cat\": \"dp\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1";
+            out << ", \"ts\": " << (int64_t)(1e6 * node.start);
+            out << ", \"dur\": " << (int64_t)(1e6 * (node.end - node.start));
+            out << ", \"args\": {";
+            writeFields_(out, node, "\"", ": ", ", ");
+            out << "}}";
+        }
+        out << "\n], \"displayTimeUnit\": \"ms\"}\n";
+    }
+    
+    // Writes the merge trees as a DOT graph with the profile of each node in
+    // its label.
+    void writeDot(ostream& out) const {
+        out << "digraph {\n";
+        out << "  node [shape=box]\n";
+        for(int i = 0; i < (int)nodes_.size(); ++i) {
+            const MergeProfileNode& node = nodes_[i];
+            out << "  " << i << " [label=\"" << (node.left == -1 ? "leaf " : "merge ") << i << "\\n";
+            writeFields_(out, node, "", " = ", "\\n");
+            out << "\"]\n";
+            if(node.left != -1) {
+                out << "  " << i << " -> " << node.left << " [label=\"left\"]\n";
+                out << "  " << i << " -> " << node.right << " [label=\"right\"]\n";
+            }
+        }
+        out << "}\n";
+    }
+    
+private:
+    chrono::steady_clock::time_point startTime_;
+    vector<MergeProfileNode> nodes_;
+    
+    static void writeFields_(
+        ostream& out,
+        const MergeProfileNode& node,
+        const char* quote,
+        const char* assign,
+        const char* sep
+    ) {
+        out << quote << "vertices" << quote << assign << node.vertCount << sep;
+        if(node.left != -1) {
+            out << quote << "left_size" << quote << assign << node.leftSize << sep;
+            out << quote << "right_size" << quote << assign << node.rightSize << sep;
+            out << quote << "pairs_examined" << quote << assign << node.counts.examined << sep;
+            out << quote << "pairs_accepted" << quote << assign << node.counts.accepted << sep;
+            out << quote << "groups_convolved" << quote << assign << node.counts.convolvedGroups << sep;
+        }
+        out << quote << "output_size" << quote << assign << node.outputSize << sep;
+        out << quote << "self_seconds" << quote << assign << node.selfSeconds << sep;
+        out << quote << "bytes_allocated" << quote << assign << node.bytesAllocated;
+    }
+};
+
+inline thread_local MergeProfiler* activeMergeProfiler = nullptr;
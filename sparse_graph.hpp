@@ -0,0 +1,277 @@
+#pragma once
+
+#include "common.hpp"
+
+// Directed graph stored as compressed sparse rows of outgoing edges. Unlike
+// Graph<N>, the memory use is linear in the numbers of vertices and edges,
+// which makes it suitable for large sparse inputs.
+class SparseGraph {
+public:
+    SparseGraph() : size_(0), offsets_(1, 0) { }
+    
+    // Constructs the graph from the list of directed edges a -> b. Duplicate
+    // edges are merged. Runs in time linear in the size of the graph.
+    SparseGraph(int size, const vector<pair<int, int>>& edges)
+        : size_(size),
+          offsets_((size_t)size + 1, 0),
+          targets_(edges.size())
+    {
+        assert(size >= 0);
+        for(pair<int, int> edge : edges) {
+            assert(edge.first >= 0 && edge.first < size);
+            assert(edge.second >= 0 && edge.second < size);
+            assert(edge.first != edge.second);
+            ++offsets_[edge.first + 1];
+        }
+        for(int v = 0; v < size; ++v) {
+            offsets_[v + 1] += offsets_[v];
+        }
+        vector<size_t> pos(offsets_.begin(), offsets_.end() - 1);
+        for(pair<int, int> edge : edges) {
+            targets_[pos[edge.first]++] = edge.second;
+        }
+        
+        // Remove duplicates by marking the targets of each vertex in turn
+        vector<int> mark(size, -1);
+        size_t out = 0;
+        size_t start = 0;
+        for(int v = 0; v < size; ++v) {
+            size_t end = offsets_[v + 1];
+            for(size_t i = start; i < end; ++i) {
+                int x = targets_[i];
+                if(mark[x] != v) {
+                    mark[x] = v;
+                    targets_[out++] = x;
+                }
+            }
+            start = end;
+            offsets_[v + 1] = out;
+        }
+        targets_.resize(out);
+    }
+    
+    int size() const {
+        return size_;
+    }
+    
+    size_t edgeCount() const {
+        return targets_.size();
+    }
+    
+    int outDegree(int v) const {
+        assert(v >= 0 && v < size_);
+        return offsets_[v + 1] - offsets_[v];
+    }
+    
+    template <typename F>
+    void iterateEdgesOut(int v, F f) const {
+        assert(v >= 0 && v < size_);
+        for(size_t i = offsets_[v]; i < offsets_[v + 1]; ++i) {
+            f(targets_[i]);
+        }
+    }
+    
+    // The graph containing the edges a -> b for which b -> a is also an edge,
+    // i.e. the undirected part of the graph.
+    SparseGraph undirectedPart() const {
+        SparseGraph reverse = reversed();
+        
+        vector<pair<int, int>> edges;
+        vector<int> mark(size_, -1);
+        for(int v = 0; v < size_; ++v) {
+            iterateEdgesOut(v, [&](int x) {
+                mark[x] = v;
+            });
+            reverse.iterateEdgesOut(v, [&](int x) {
+                if(mark[x] == v) {
+                    edges.emplace_back(v, x);
+                }
+            });
+        }
+        
+        return SparseGraph(size_, edges);
+    }
+    
+    // The graph containing the edges a -> b for which b -> a is not an edge,
+    // i.e. the directed part of the graph.
+    SparseGraph directedPart() const {
+        SparseGraph reverse = reversed();
+        
+        vector<pair<int, int>> edges;
+        vector<int> mark(size_, -1);
+        for(int v = 0; v < size_; ++v) {
+            reverse.iterateEdgesOut(v, [&](int x) {
+                mark[x] = v;
+            });
+            iterateEdgesOut(v, [&](int x) {
+                if(mark[x] != v) {
+                    edges.emplace_back(v, x);
+                }
+            });
+        }
+        
+        return SparseGraph(size_, edges);
+    }
+    
+    // The graph with every edge reversed.
+    SparseGraph reversed() const {
+        vector<pair<int, int>> edges;
+        edges.reserve(targets_.size());
+        for(int v = 0; v < size_; ++v) {
+            iterateEdgesOut(v, [&](int x) {
+                edges.emplace_back(x, v);
+            });
+        }
+        return SparseGraph(size_, edges);
+    }
+    
+    // Clique forest with one clique tree for each connected component.
+    // parents[i] is the index of the parent of clique i, or -1 if clique i is
+    // the root of its component. Parents precede their children, and the
+    // vertices of each clique are sorted.
+    struct TreeDecomposition {
+        vector<vector<int>> cliques;
+        vector<int> parents;
+        
+        // The vertices in the order of the maximum cardinality search
+        vector<int> order;
+    };
+    
+    // Assuming that the graph is undirected and chordal, finds its maximal
+    // cliques and a clique tree for each connected component in linear time
+    // using maximum cardinality search (Blair & Peyton 1993).
+    TreeDecomposition findTreeDecompositionInChordal() const {
+        TreeDecomposition ret;
+        
+        // Unvisited vertices in doubly linked buckets by the number of
+        // visited neighbors
+        vector<int> label(size_, 0);
+        vector<int> head((size_t)size_ + 1, -1);
+        vector<int> next(size_);
+        vector<int> prev(size_);
+        auto insert = [&](int v) {
+            int l = label[v];
+            prev[v] = -1;
+            next[v] = head[l];
+            if(head[l] != -1) {
+                prev[head[l]] = v;
+            }
+            head[l] = v;
+        };
+        auto remove = [&](int v) {
+            if(prev[v] != -1) {
+                next[prev[v]] = next[v];
+            } else {
+                head[label[v]] = next[v];
+            }
+            if(next[v] != -1) {
+                prev[next[v]] = prev[v];
+            }
+        };
+        for(int v = size_ - 1; v >= 0; --v) {
+            insert(v);
+        }
+        
+        vector<int> visitIndex(size_, -1);
+        vector<int> cliqueOf(size_);
+        int maxLabel = 0;
+        int prevLabel = 0;
+        for(int i = 0; i < size_; ++i) {
+            while(head[maxLabel] == -1) {
+                --maxLabel;
+            }
+            int v = head[maxLabel];
+            remove(v);
+            visitIndex[v] = i;
+            ret.order.push_back(v);
+            
+            if(label[v] <= prevLabel) {
+                // Start a new clique from v and its visited neighbors, attached
+                // to the clique of the most recently visited one
+                vector<int> clique;
+                int last = -1;
+                iterateEdgesOut(v, [&](int x) {
+                    if(visitIndex[x] != -1 && x != v) {
+                        clique.push_back(x);
+                        if(last == -1 || visitIndex[x] > visitIndex[last]) {
+                            last = x;
+                        }
+                    }
+                });
+                assert((int)clique.size() == label[v]);
+                clique.push_back(v);
+                ret.cliques.push_back(move(clique));
+                ret.parents.push_back(last == -1 ? -1 : cliqueOf[last]);
+            } else {
+                ret.cliques.back().push_back(v);
+            }
+            cliqueOf[v] = (int)ret.cliques.size() - 1;
+            prevLabel = label[v];
+            
+            iterateEdgesOut(v, [&](int x) {
+                if(visitIndex[x] == -1) {
+                    remove(x);
+                    ++label[x];
+                    insert(x);
+                    maxLabel = max(maxLabel, label[x]);
+                }
+            });
+        }
+        
+        for(vector<int>& clique : ret.cliques) {
+            sort(clique.begin(), clique.end());
+        }
+        
+        return ret;
+    }
+    
+    // Assuming that the graph is undirected, checks whether the neighbors of
+    // each vertex that precede it in order form a clique, i.e. whether the
+    // reverse of order is a perfect elimination ordering. For the order of a
+    // maximum cardinality search, this holds if and only if the graph is
+    // chordal (Tarjan & Yannakakis 1984). Runs in linear time: it suffices
+    // that the other earlier neighbors of each vertex are neighbors of its
+    // latest earlier neighbor.
+    bool isReversePerfectEliminationOrdering(const vector<int>& order) const {
+        assert((int)order.size() == size_);
+        vector<int> index(size_);
+        for(int i = 0; i < size_; ++i) {
+            index[order[i]] = i;
+        }
+        
+        // The earlier neighbors of each vertex that have to be adjacent to
+        // the vertex that they are listed for
+        vector<vector<int>> required(size_);
+        for(int v : order) {
+            int last = -1;
+            iterateEdgesOut(v, [&](int x) {
+                if(index[x] < index[v] && (last == -1 || index[x] > index[last])) {
+                    last = x;
+                }
+            });
+            iterateEdgesOut(v, [&](int x) {
+                if(index[x] < index[v] && x != last) {
+                    required[last].push_back(x);
+                }
+            });
+        }
+        
+        vector<int> mark(size_, -1);
+        for(int v = 0; v < size_; ++v) {
+            iterateEdgesOut(v, [&](int x) {
+                mark[x] = v;
+            });
+            for(int x : required[v]) {
+                if(mark[x] != v) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    
+private:
+    int size_;
+    vector<size_t> offsets_;
+    vector<int> targets_;
+};
@@ -39,6 +39,27 @@ void test_conversions() {
     }
 };
 
+void test_transposeBitMatrix64() {
+    for(int t = 0; t < 100; ++t) {
+        uint64_t a[64];
+        for(int i = 0; i < 64; ++i) {
+            a[i] = UnifInt<uint64_t>()(rng) & UnifInt<uint64_t>()(rng);
+        }
+        uint64_t b[64];
+        copy(a, a + 64, b);
+        transposeBitMatrix64(b);
+        for(int i = 0; i < 64; ++i) {
+            for(int j = 0; j < 64; ++j) {
+                checkEqual((a[i] >> j) & 1, (b[j] >> i) & 1);
+            }
+        }
+        transposeBitMatrix64(b);
+        for(int i = 0; i < 64; ++i) {
+            checkEqual(a[i], b[i]);
+        }
+    }
+}
+
 template <int W>
 struct TestBitSet {
     typedef BitSet<W> B;
@@ -126,6 +147,16 @@ struct TestBitSet {
             B y = B::fromWord(m);
             checkEqual(y, setIntersection(x, B::range(64)));
         }
+        
+        for(int t = 0; t < 100; ++t) {
+            B x = randomBitSet();
+            B y;
+            for(int w = 0; w < W; ++w) {
+                checkEqual(x.word(w), setIntersection(x, B::range(64 * w, 64 * w + 64)).shifted(-64 * w).bottomWord());
+                y.setWord(w, x.word(w));
+            }
+            checkEqual(x, y);
+        }
     }
     
     static void testAccessors() {
@@ -414,6 +445,27 @@ struct TestBitSet {
             
             checkEqual(isSubset(x, y), setDifference(x, y).isEmpty());
         }
+        
+        for(int t = 0; t < 100; ++t) {
+            int count = UnifInt<int>(0, 40)(rng);
+            vector<B> sets;
+            for(int i = 0; i < count; ++i) {
+                sets.push_back(randomBitSet());
+            }
+            B x = randomBitSet();
+            
+            vector<size_t> expected;
+            for(int i = 0; i < count; ++i) {
+                if(setIntersection(sets[i], x).isEmpty()) {
+                    expected.push_back(i);
+                }
+            }
+            vector<size_t> got;
+            B::forEachDisjoint(sets.data(), sets.size(), x, [&](size_t i) {
+                got.push_back(i);
+            });
+            checkEqual(got, expected);
+        }
     }
     
     static void testAll() {
@@ -443,5 +495,7 @@ int main() {
     test_conversions<3, 2>();
     test_conversions<3, 3>();
     
+    test_transposeBitMatrix64();
+    
     return 0;
 }
@@ -1,5 +1,9 @@
 #include "test.hpp"
 
+#include "arena.hpp"
+
+#include <thread>
+
 namespace {
 
 template <int X>
@@ -81,11 +85,164 @@ void test_fastMemoryComparison() {
 template <>
 void test_fastMemoryComparison<-1>() { }
 
+void test_combinatorics() {
+    Z fact = 1;
+    for(int n = 0; n <= 200; ++n) {
+        if(n > 0) {
+            fact *= n;
+        }
+        checkEqual(factorial(n), fact);
+        
+        Z binom = 1;
+        for(int k = 0; k <= n; ++k) {
+            checkEqual(binomial(n, k), binom);
+            checkEqual(fallingFactorial(n, k), (Z)(binom * factorial(k)));
+            binom = binom * (n - k) / (k + 1);
+        }
+        checkEqual(binomial(n, -1), Z(0));
+        checkEqual(binomial(n, n + 1), Z(0));
+    }
+    
+    // Extending the tables from many threads at once gives the same values
+    // as extending them sequentially
+    const int ThreadCount = 4;
+    const int Start = 200;
+    const int End = 600;
+    vector<vector<Z>> results(ThreadCount);
+    vector<thread> threads;
+    for(int t = 0; t < ThreadCount; ++t) {
+        threads.emplace_back([&, t]() {
+            for(int n = t % 2 ? End - 1 : Start; n >= Start && n < End; n += t % 2 ? -1 : 1) {
+                results[t].push_back(factorial(n) + binomial(n, n / 3));
+            }
+            if(t % 2) {
+                reverse(results[t].begin(), results[t].end());
+            }
+        });
+    }
+    for(thread& th : threads) {
+        th.join();
+    }
+    for(int n = Start; n < End; ++n) {
+        mpz_fac_ui(fact.get_mpz_t(), n);
+        Z binom;
+        mpz_bin_uiui(binom.get_mpz_t(), n, n / 3);
+        for(int t = 0; t < ThreadCount; ++t) {
+            checkEqual(results[t][n - Start], (Z)(fact + binom));
+        }
+    }
+}
+
+void test_addProduct() {
+    Z a("123456789012345678901234567890");
+    Z b("-98765432109876543210");
+    Z x;
+    addProduct(x, a, b);
+    checkEqual(x, (Z)(a * b));
+    addProduct(x, a, a);
+    checkEqual(x, (Z)(a * b + a * a));
+    addProduct(x, b, 0);
+    checkEqual(x, (Z)(a * b + a * a));
+    
+    Z y = 7;
+    addProduct(y, y, y);
+    checkEqual(y, (Z)56);
+}
+
+void test_subsetConvolution() {
+    for(int k = 0; k <= 6; ++k) {
+        size_t n = (size_t)1 << k;
+        vector<Z> f(n);
+        vector<Z> g(n);
+        for(size_t s = 0; s < n; ++s) {
+            f[s] = UnifInt<int>(-1000, 1000)(rng);
+            g[s] = UnifInt<int>(0, 3)(rng) ? Z(UnifInt<int>(-1000, 1000)(rng)) : Z(0);
+        }
+        f[0] = Z("123456789012345678901234567890");
+        
+        vector<Z> expected(n);
+        for(size_t a = 0; a < n; ++a) {
+            for(size_t b = 0; b < n; ++b) {
+                if((a & b) == 0) {
+                    expected[a | b] += f[a] * g[b];
+                }
+            }
+        }
+        checkEqual(subsetConvolution(f, g, k), expected);
+    }
+}
+
+void test_arena() {
+    uint64_t inUseStart = arenaStats.bytesInUse;
+    uint64_t allocatedStart = arenaStats.bytesAllocated;
+    
+    {
+        Arena arena;
+        vector<pair<char*, int>> blocks;
+        for(int i = 0; i < 1000; ++i) {
+            int size = 1 + i % 97 + (i % 100 == 0 ? 100000 : 0);
+            size_t align = (size_t)1 << (i % 5);
+            char* p = (char*)arena.allocate(size, align);
+            checkEqual((uintptr_t)p % align, (uintptr_t)0);
+            memset(p, i & 0xFF, size);
+            blocks.emplace_back(p, size);
+        }
+        for(int i = 0; i < (int)blocks.size(); ++i) {
+            for(int j = 0; j < blocks[i].second; ++j) {
+                checkEqual((int)(unsigned char)blocks[i].first[j], i & 0xFF);
+            }
+        }
+        checkTrue(arena.bytesInUse() > 0);
+        checkEqual(arenaStats.bytesInUse, inUseStart + arena.bytesInUse());
+        checkLessOrEqual(arenaStats.bytesInUse, arenaStats.peakBytesInUse);
+        
+        arena.reset();
+        checkEqual(arena.bytesInUse(), (size_t)0);
+        checkEqual(arenaStats.bytesInUse, inUseStart);
+        
+        // The arena can be used again after reset
+        int* x = (int*)arena.allocate(sizeof(int), alignof(int));
+        *x = 5;
+        checkEqual(*x, 5);
+    }
+    checkEqual(arenaStats.bytesInUse, inUseStart);
+    checkTrue(arenaStats.bytesAllocated > allocatedStart);
+    
+    // Each container has its own arena, released when the container dies,
+    // and copies do not share the arena of the original
+    typedef map<int, int, less<int>, ArenaAllocator<pair<const int, int>>> M;
+    {
+        M a;
+        for(int i = 0; i < 10000; ++i) {
+            a[i] = 2 * i;
+        }
+        uint64_t inUseA = arenaStats.bytesInUse;
+        checkTrue(inUseA > inUseStart);
+        {
+            M b = a;
+            checkTrue(b.get_allocator() != a.get_allocator());
+            checkTrue(arenaStats.bytesInUse > inUseA);
+        }
+        checkEqual(arenaStats.bytesInUse, inUseA);
+        
+        M c;
+        c = move(a);
+        checkEqual(arenaStats.bytesInUse, inUseA);
+        checkEqual((int)c.size(), 10000);
+        checkEqual(c[1234], 2468);
+    }
+    checkEqual(arenaStats.bytesInUse, inUseStart);
+}
+
 }
 
 int main() {
     test_select2Pow();
     test_fastMemoryComparison<20>();
+    test_combinatorics();
+    test_addProduct();
+    test_subsetConvolution();
+    test_arena();
     
     return 0;
 }
@@ -1,6 +1,6 @@
 #include "test.hpp"
 
-#include "graph.hpp"
+#include "graph_io.hpp"
 
 namespace {
 
@@ -23,9 +23,27 @@ void test_selectGraphParam() {
     }
 }
 
+void test_bitShuffles() {
+    for(int t = 0; t < 1000; ++t) {
+        uint32_t x = UnifInt<uint32_t>()(rng);
+        uint32_t packed = 0;
+        for(int i = 0; i < 16; ++i) {
+            packed |= ((x >> (2 * i)) & 1) << i;
+        }
+        checkEqual(packEvenBits(x), packed);
+    }
+    for(uint64_t x = 0; x < 16; ++x) {
+        uint64_t spread = 0;
+        for(int i = 0; i < 4; ++i) {
+            spread |= ((x >> i) & 1) << (16 * i);
+        }
+        checkEqual(spreadNibble16(x), spread);
+    }
+}
+
 void test_readGraph() {
     for(int t = 0; t < 100; ++t) {
-        int n = UnifInt<int>(0, min(DefaultMaxGraphSize, 64))(rng);
+        int n = UnifInt<int>(0, min(DefaultMaxGraphSize, 150))(rng);
         
         double p = UnifReal<double>(-0.05, 1.05)(rng);
         
@@ -39,16 +57,26 @@ void test_readGraph() {
             }
         }
         
+        bool irregular = rng() & 1;
+        auto separator = [&](char def) {
+            if(irregular) {
+                const char* seps[] = {" ", "\n", "\t", "\r\n", "  ", " \n "};
+                return string(seps[UnifInt<int>(0, 5)(rng)]);
+            } else {
+                return string(1, def);
+            }
+        };
+        
         stringstream ss;
-        ss << n << '\n';
+        ss << n << separator('\n');
         for(int i = 0; i < n; ++i) {
             for(int j = 0; j < n; ++j) {
                 if(j) {
-                    ss << ' ';
+                    ss << separator(' ');
                 }
                 ss << (int)vals[i][j];
             }
-            ss << '\n';
+            ss << separator('\n');
         }
         
         ss.seekg(0);
@@ -68,6 +96,24 @@ void test_readGraph() {
             
             checkEqual(g, g2);
             
+            if(!irregular) {
+                stringstream ss2;
+                g.write(ss2);
+                checkEqual(ss2.str(), ss.str());
+            }
+            
+            stringstream ss3;
+            g.writeEdgeList(ss3);
+            GraphData edgeListData = GraphData::read(ss3);
+            checkEqual(edgeListData.size(), n);
+            edgeListData.accessGraph<g.ParamN>([&](auto g3) {
+                for(int i = 0; i < n; ++i) {
+                    for(int j = 0; j < n; ++j) {
+                        checkEqual(g3(i, j), (bool)vals[i][j]);
+                    }
+                }
+            });
+            
             called = true;
         });
         checkTrue(called);
@@ -82,6 +128,67 @@ void test_readGraph() {
     }
 }
 
+void test_graphContainer() {
+    for(int t = 0; t < 20; ++t) {
+        vector<Graph<150>> graphs;
+        int count = UnifInt<int>(0, 10)(rng);
+        for(int i = 0; i < count; ++i) {
+            int n = UnifInt<int>(0, 150)(rng);
+            double p = UnifReal<double>(-0.05, 0.3)(rng);
+            Graph<150> g(n);
+            for(int a = 0; a < n; ++a) {
+                for(int b = 0; b < n; ++b) {
+                    if(a != b && UnifReal<double>(0.0, 1.0)(rng) < p) {
+                        g.addD(a, b);
+                    }
+                }
+            }
+            graphs.push_back(g);
+        }
+        
+        stringstream ss;
+        GraphContainerWriter writer(ss);
+        for(const Graph<150>& g : graphs) {
+            writer.write(g);
+        }
+        writer.finish();
+        string data = ss.str();
+        
+        auto check = [&](const GraphContainer& container) {
+            checkEqual(container.count(), graphs.size());
+            for(int i = 0; i < count; ++i) {
+                bool called = false;
+                container.graph(i).accessGraph<150>([&](auto g) {
+                    checkEqual(g.size(), graphs[i].size());
+                    for(int a = 0; a < g.size(); ++a) {
+                        for(int b = 0; b < g.size(); ++b) {
+                            checkEqual(g.edgesOut(a).has(b), graphs[i].edgesOut(a).has(b));
+                        }
+                        checkEqual(g.edgesIn(a).count(), graphs[i].edgesIn(a).count());
+                    }
+                    called = true;
+                });
+                checkTrue(called);
+            }
+        };
+        
+        auto buf = make_shared<vector<uint64_t>>((data.size() + 7) / 8);
+        memcpy(buf->data(), data.data(), data.size());
+        checkTrue(GraphContainer::isContainer((const char*)buf->data(), data.size()));
+        check(GraphContainer((const char*)buf->data(), data.size(), buf));
+        
+        FILE* file = tmpfile();
+        checkTrue(file != nullptr);
+        checkEqual(fwrite(data.data(), 1, data.size(), file), data.size());
+        fflush(file);
+        lseek(fileno(file), 0, SEEK_SET);
+        auto input = make_shared<MappedInput>(fileno(file));
+        checkEqual(string(input->data(), input->size()), data);
+        check(GraphContainer(input->data(), input->size(), input));
+        fclose(file);
+    }
+}
+
 template <int N>
 struct TestGraph {
     typedef Graph<N> G;
@@ -715,7 +822,7 @@ struct TestGraph {
             for(int v = 0; v < n; ++v) {
                 checkEqual(g.bidirectionalComponent(v), g.vertexSet());
             }
-            
+        
         }
         
         for(int t = 0; t < 100; ++t) {
@@ -1056,6 +1163,24 @@ struct TestGraph {
             }
         }
         
+        for(int t = 0; t < 100; ++t) {
+            G g;
+            do {
+                g = randomGraph();
+            } while(!g.isChordal());
+            
+            for(int a = 0; a < g.size(); ++a) {
+                for(int b = 0; b < g.size(); ++b) {
+                    if(a == b || g(a, b) || g(b, a)) {
+                        continue;
+                    }
+                    G h = g;
+                    h.addU(a, b);
+                    checkEqual(g.isChordalAfterAddUInChordal(a, b), h.isChordal());
+                }
+            }
+        }
+        
         for(int t = 0; t < 100; ++t) {
             int n = UnifInt<int>(0, min(N, 30))(rng);
             int e = 0;
@@ -1079,6 +1204,27 @@ struct TestGraph {
             }
         }
         
+        for(int t = 0; t < 100; ++t) {
+            int n = UnifInt<int>(0, min(N, 30))(rng);
+            int k = UnifInt<int>(1, 5)(rng);
+            
+            G g = G::randomKTree(n, k);
+            checkEqual(g.size(), n);
+            
+            int edgeCount = 0;
+            for(int v = 0; v < n; ++v) {
+                edgeCount += g.edgesIn(v).count();
+            }
+            int m = min(n, k + 1);
+            checkEqual(edgeCount, m * (m - 1) + 2 * k * (n - m));
+            
+            checkTrue(g.isUndirected());
+            checkTrue(g.isChordal());
+            if(n > 0) {
+                checkEqual(g.component(0), g.vertexSet());
+            }
+        }
+        
         for(int t = 0; t < 100; ++t) {
             int n = UnifInt<int>(0, min(N, 30))(rng);
             int e = 0;
@@ -1178,7 +1324,9 @@ int main() {
     TestGraph<23>::testAll();
     TestGraph<121>::testAll();
     
+    test_bitShuffles();
     test_readGraph();
-
+    test_graphContainer();
+    
     return 0;
 }
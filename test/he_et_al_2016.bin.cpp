@@ -37,14 +37,51 @@ void testGraph(const G& graph) {
             graphM2 = graphM2.withShuffledVertices();
             
             checkEqual(
-                (Z)(poly(m2 - m1) * FactorialTable<N>::get(m2 - m1)),
+                (Z)(poly(m2 - m1) * factorial(m2 - m1)),
                 countMAOUsingTreeDecompositionDP(graphM2)
             );
         }
     }
 }
 
+Polynomial randomPolynomial() {
+    vector<Z> coef(UnifInt<int>(0, 6)(rng));
+    for(Z& x : coef) {
+        x = UnifInt<int>(-5, 5)(rng);
+    }
+    return Polynomial(coef);
+}
+
+void testPolynomial() {
+    for(int t = 0; t < 100; ++t) {
+        Polynomial p = randomPolynomial();
+        Polynomial r = randomPolynomial();
+        int d = UnifInt<int>(0, 4)(rng);
+        int a = UnifInt<int>(-5, 5)(rng);
+        int b = UnifInt<int>(1, 6)(rng);
+        
+        Polynomial translated = p.translate(d);
+        
+        // p + r a / b, which is integer-valued after multiplying by b
+        Polynomial q = p;
+        q.addMul(r, a, b);
+        q.mul(b);
+        q.reduce();
+        
+        for(int x = 0; x <= 5; ++x) {
+            Z expected = p(x + d);
+            for(int i = 1; i <= d; ++i) {
+                expected *= x + i;
+            }
+            checkEqual(translated(x), expected);
+            checkEqual(q(x), (Z)(b * p(x) + a * r(x)));
+        }
+    }
+}
+
 int main() {
+    testPolynomial();
+    
     testGraph(G(0));
     
     for(int t = 0; t < 100; ++t) {
@@ -2,6 +2,8 @@
 
 #include "mao.hpp"
 
+#include <dirent.h>
+
 namespace {
 
 template <int N>
@@ -74,6 +76,7 @@ struct TestMAOFundamentals {
                 int b = perm[(i + 1) % k];
                 g.delD(b, a);
                 checkFalse(isValidEssentialGraph(g));
+                checkFalse(isValidEssentialGraph(*GraphData(g).sparseGraph()));
             }
         }
         for(int t = 0; t < 100; ++t) {
@@ -84,6 +87,31 @@ struct TestMAOFundamentals {
             }
             G g = G::randomConnectedChordal(n, e);
             checkTrue(isValidEssentialGraph(g));
+            checkTrue(isValidEssentialGraph(*GraphData(g).sparseGraph()));
+        }
+        
+        // The sparse check agrees with the dense one on graphs with both
+        // directed and undirected edges, which are small enough to be valid
+        // essential graphs every now and then
+        for(int t = 0; t < 1000; ++t) {
+            int n = UnifInt<int>(0, min(N, 7))(rng);
+            G g(n);
+            double p = UnifReal<double>(0.0, 1.0)(rng);
+            double q = UnifReal<double>(0.0, 1.0)(rng);
+            for(int i = 0; i < n; ++i) {
+                for(int j = i + 1; j < n; ++j) {
+                    if(UnifReal<double>(0.0, 1.0)(rng) < p) {
+                        if(UnifReal<double>(0.0, 1.0)(rng) < q) {
+                            g.addU(i, j);
+                        } else if(UnifInt<int>(0, 1)(rng)) {
+                            g.addD(i, j);
+                        } else {
+                            g.addD(j, i);
+                        }
+                    }
+                }
+            }
+            checkEqual(isValidEssentialGraph(*GraphData(g).sparseGraph()), isValidEssentialGraph(g));
         }
     }
     
@@ -98,7 +126,7 @@ struct TestCountIterateMAO {
     typedef Graph<N> G;
     
     struct GraphCmp {
-        bool operator()(const G& a, const G& b) {
+        bool operator()(const G& a, const G& b) const {
             if(a.size() != b.size()) {
                 return a.size() < b.size();
             }
@@ -194,10 +222,286 @@ struct TestCountIterateMAO {
             for(const auto& p : countMAOMethods) {
                 checkEqual((Z)results.size(), p.second(g));
             }
+            checkEqual((Z)results.size(), countMAOUsingTreeDecompositionDP(GraphData(*GraphData(g).sparseGraph())));
         }
     }
 };
 
+void testMergeProfiler() {
+    for(int t = 0; t < 20; ++t) {
+        int n = UnifInt<int>(1, 20)(rng);
+        int e = UnifInt<int>(n - 1, min(n * (n - 1) / 2, 2 * n))(rng);
+        GraphData graph(Graph<32>::randomConnectedChordal(n, e));
+        
+        for(auto method : {countMAOUsingTreeDecompositionDP, countMAOUsingTreeDecompositionDPSymmetryReduction}) {
+            MergeProfiler profiler;
+            activeMergeProfiler = &profiler;
+            Z count = method(graph);
+            activeMergeProfiler = nullptr;
+            checkEqual(count, method(graph));
+            
+            const vector<MergeProfileNode>& nodes = profiler.nodes();
+            checkFalse(nodes.empty());
+            vector<int> parentCount(nodes.size());
+            for(int i = 0; i < (int)nodes.size(); ++i) {
+                const MergeProfileNode& node = nodes[i];
+                checkTrue(node.start <= node.end);
+                checkLessOrEqual(node.counts.accepted, node.counts.examined);
+                if(node.left != -1) {
+                    checkTrue(node.left < node.right && node.right < i);
+                    checkEqual(node.leftSize, nodes[node.left].outputSize);
+                    checkEqual(node.rightSize, nodes[node.right].outputSize);
+                    ++parentCount[node.left];
+                    ++parentCount[node.right];
+                }
+            }
+            checkEqual(parentCount.back(), 0);
+            for(int i = 0; i + 1 < (int)nodes.size(); ++i) {
+                checkEqual(parentCount[i], 1);
+            }
+        }
+    }
+}
+
+void testCancellation() {
+    for(int t = 0; t < 10; ++t) {
+        int n = UnifInt<int>(6, 8)(rng);
+        int e = UnifInt<int>(n + 2, n * (n - 1) / 2 - 4)(rng);
+        GraphData graph(Graph<32>::randomConnectedChordal(n, e));
+        
+        for(const auto& method : countMAOMethods) {
+            Z count = method.second(graph);
+            
+            auto checkStops = [&](CancellationToken& token, CountMAOCancelled::Reason reason) {
+                activeCancellationToken = &token;
+                bool stopped = false;
+                try {
+                    method.second(graph);
+                } catch(const CountMAOCancelled& e) {
+                    stopped = true;
+                    checkEqual((int)e.reason(), (int)reason);
+                }
+                activeCancellationToken = nullptr;
+                checkTrue(stopped);
+            };
+            
+            CancellationToken cancelled;
+            cancelled.cancel();
+            checkStops(cancelled, CountMAOCancelled::Cancelled);
+            
+            CancellationToken timeLimited;
+            timeLimited.setTimeLimit(0.0);
+            checkStops(timeLimited, CountMAOCancelled::TimeLimit);
+            
+            CancellationToken memoryLimited;
+            memoryLimited.setMemoryLimit(1);
+            checkStops(memoryLimited, CountMAOCancelled::MemoryLimit);
+            
+            // A stopped method leaves nothing behind, and progress reporting
+            // does not change the result
+            int progressCount = 0;
+            CancellationToken progress;
+            progress.setProgressCallback(0.0, [&](const CountMAOProgress& p) {
+                checkLessOrEqual(p.steps, progress.steps());
+                ++progressCount;
+            });
+            activeCancellationToken = &progress;
+            checkEqual(method.second(graph), count);
+            activeCancellationToken = nullptr;
+            checkTrue(progressCount > 0);
+        }
+    }
+}
+
+void testPortfolio() {
+    for(int t = 0; t < 10; ++t) {
+        int n = UnifInt<int>(16, 40)(rng);
+        int e = UnifInt<int>(n - 1, min(n * (n - 1) / 2, 4 * n))(rng);
+        GraphData graph(Graph<64>::randomConnectedChordal(n, e));
+        checkEqual(countMAOUsingPortfolio(graph), countMAOUsingTreeDecompositionDP(graph));
+    }
+    
+    // Every ordering of the complete graph on 30 vertices is an MAO, so
+    // enumerating its 30! MAOs cannot finish and the enumeration has to be
+    // cancelled when the DP finishes
+    vector<string> origMethods = portfolioMethods;
+    portfolioMethods = {"Enumeration", "Dynamic Programming"};
+    Graph<64> complete(30);
+    for(int i = 0; i < 30; ++i) {
+        for(int j = 0; j < 30; ++j) {
+            if(i != j) {
+                complete.addD(i, j);
+            }
+        }
+    }
+    GraphData graph(complete);
+    checkEqual(countMAOUsingPortfolio(graph), factorial(30));
+    
+    // Cancelling the caller cancels the raced methods
+    portfolioMethods = {"Enumeration"};
+    CancellationToken token;
+    token.setTimeLimit(0.1);
+    activeCancellationToken = &token;
+    bool stopped = false;
+    try {
+        countMAOUsingPortfolio(graph);
+    } catch(const CountMAOCancelled& e) {
+        stopped = true;
+        checkEqual((int)e.reason(), (int)CountMAOCancelled::TimeLimit);
+    }
+    activeCancellationToken = nullptr;
+    checkTrue(stopped);
+    portfolioMethods = origMethods;
+}
+
+vector<string> listDirectory(const string& dir) {
+    vector<string> ret;
+    DIR* d = opendir(dir.c_str());
+    checkTrue(d != nullptr);
+    while(dirent* entry = readdir(d)) {
+        string name = entry->d_name;
+        if(name != "." && name != "..") {
+            ret.push_back(name);
+        }
+    }
+    closedir(d);
+    return ret;
+}
+
+void testDPCheckpoint() {
+    char dirTemplate[] = "/tmp/count_mao_checkpoint_XXXXXX";
+    checkTrue(mkdtemp(dirTemplate) != nullptr);
+    string dir = dirTemplate;
+    
+    for(int t = 0; t < 10; ++t) {
+        int n = UnifInt<int>(10, 24)(rng);
+        int e = UnifInt<int>(n - 1, min(n * (n - 1) / 2, 3 * n))(rng);
+        Graph<32> g = Graph<32>::randomConnectedChordal(n, e);
+        GraphData dense(g);
+        GraphData sparse(*dense.sparseGraph());
+        
+        for(auto method : {countMAOUsingTreeDecompositionDP, countMAOUsingTreeDecompositionDPSymmetryReduction}) {
+            for(const GraphData& graph : {dense, sparse}) {
+                Z count = method(graph);
+                
+                // Save the output of every subtree, which leaves only the
+                // checkpoints of the roots. Identical subtrees, also those
+                // of the same graph in the other form, share checkpoints.
+                DPCheckpoint checkpoint(dir, 0.0);
+                activeDPCheckpoint = &checkpoint;
+                checkEqual(method(graph), count);
+                uint64_t savedCount = checkpoint.savedCount();
+                uint64_t loadedCount = checkpoint.loadedCount();
+                checkTrue(savedCount + loadedCount > 0);
+                
+                // Resume from the saved roots
+                checkEqual(method(graph), count);
+                checkEqual(checkpoint.savedCount(), savedCount);
+                checkTrue(checkpoint.loadedCount() > loadedCount);
+                activeDPCheckpoint = nullptr;
+            }
+        }
+    }
+    
+    for(const string& name : listDirectory(dir)) {
+        checkTrue(name.substr(name.size() - 5) == ".ckpt");
+        checkEqual(unlink((dir + "/" + name).c_str()), 0);
+    }
+    checkEqual(rmdir(dir.c_str()), 0);
+}
+
+void testAnalyzeChainComponents() {
+    for(int t = 0; t < 100; ++t) {
+        int n = UnifInt<int>(0, 40)(rng);
+        int e = n ? UnifInt<int>(n - 1, min(n * (n - 1) / 2, 3 * n))(rng) : 0;
+        Graph<64> g = Graph<64>::randomConnectedChordal(n, e);
+        
+        vector<ChainComponentAnalysis> dense = analyzeChainComponents(g);
+        vector<ChainComponentAnalysis> sparse = analyzeChainComponents(GraphData(*GraphData(g).sparseGraph()));
+        checkEqual(dense.size(), (size_t)(n >= 2));
+        checkEqual(sparse.size(), dense.size());
+        for(size_t i = 0; i < dense.size(); ++i) {
+            checkEqual(dense[i].vertCount, n);
+            checkEqual(dense[i].edgeCount, e);
+            checkEqual(sparse[i].vertCount, n);
+            checkEqual(sparse[i].edgeCount, e);
+            
+            vector<int> denseCliques = dense[i].cliqueSizes;
+            vector<int> sparseCliques = sparse[i].cliqueSizes;
+            sort(denseCliques.begin(), denseCliques.end());
+            sort(sparseCliques.begin(), sparseCliques.end());
+            checkEqual(denseCliques, sparseCliques);
+            
+            // The separators of every clique tree are the same
+            vector<int> denseSeparators = dense[i].separatorSizes;
+            vector<int> sparseSeparators = sparse[i].separatorSizes;
+            sort(denseSeparators.begin(), denseSeparators.end());
+            sort(sparseSeparators.begin(), sparseSeparators.end());
+            checkEqual(denseSeparators, sparseSeparators);
+            checkEqual(denseSeparators.size() + 1, denseCliques.size());
+            
+            for(const ChainComponentAnalysis& analysis : {dense[i], sparse[i]}) {
+                const auto& nodes = analysis.mergeTree;
+                checkEqual(nodes.size(), 2 * analysis.cliqueSizes.size() - 1);
+                checkEqual(nodes.back().outputCount, 0);
+                for(int j = 0; j < (int)nodes.size(); ++j) {
+                    if(nodes[j].left != -1) {
+                        checkTrue(nodes[j].left < j && nodes[j].right < j);
+                        checkEqual(nodes[j].vertCount, nodes[nodes[j].left].outputCount);
+                    }
+                    checkLessOrEqual(nodes[j].outputCount, nodes[j].vertCount);
+                }
+            }
+        }
+    }
+}
+
+void testSparseTreeDecompositionDP() {
+    // Edge lists are always counted by the sparse pipeline, which rejects
+    // the four-cycle as it is not chordal but accepts it with a chord
+    istringstream cycleIn("edges 4\n0 -- 1\n1 -- 2\n2 -- 3\n3 -- 0\n");
+    GraphData cycle = GraphData::read(cycleIn);
+    checkTrue(cycle.isSparse());
+    checkFalse(isValidEssentialGraph(*cycle.sparseGraph()));
+    istringstream chordIn("edges 4\n0 -- 1\n1 -- 2\n2 -- 3\n3 -- 0\n0 -- 2\n");
+    GraphData chord = GraphData::read(chordIn);
+    checkTrue(isValidEssentialGraph(*chord.sparseGraph()));
+    checkEqual(countMAOUsingTreeDecompositionDP(chord), countMAOUsingDynamicProgramming(chord));
+    
+    for(int t = 0; t < 100; ++t) {
+        int n = UnifInt<int>(1, 60)(rng);
+        int e = UnifInt<int>(n - 1, min(n * (n - 1) / 2, 3 * n))(rng);
+        Graph<64> g = Graph<64>::randomConnectedChordal(n, e);
+        GraphData sparseData(*GraphData(g).sparseGraph());
+        checkTrue(sparseData.isSparse());
+        checkEqual(
+            countMAOUsingTreeDecompositionDP(sparseData),
+            countMAOUsingTreeDecompositionDP(g)
+        );
+    }
+    
+    // An undirected tree has one MAO for each choice of the root, and the
+    // count of a graph is the product over its chain components
+    for(int t = 0; t < 10; ++t) {
+        int n = UnifInt<int>(DefaultMaxGraphSize + 1, 3 * DefaultMaxGraphSize)(rng);
+        int k = UnifInt<int>(1, 5)(rng);
+        vector<pair<int, int>> edges;
+        Z expected = 1;
+        int start = 0;
+        for(int c = 0; c < k; ++c) {
+            int end = c == k - 1 ? n : UnifInt<int>(start + 1, start + n / k)(rng);
+            for(int v = start + 1; v < end; ++v) {
+                int p = UnifInt<int>(start, v - 1)(rng);
+                edges.emplace_back(v, p);
+                edges.emplace_back(p, v);
+            }
+            expected *= end - start;
+            start = end;
+        }
+        checkEqual(countMAOUsingTreeDecompositionDP(GraphData(SparseGraph(n, edges))), expected);
+    }
+}
+
 }
 
 int main() {
@@ -218,5 +522,12 @@ int main() {
     TestCountIterateMAO<5>::testAll();
     TestCountIterateMAO<6>::testAll();
     
+    testMergeProfiler();
+    testCancellation();
+    testPortfolio();
+    testDPCheckpoint();
+    testAnalyzeChainComponents();
+    testSparseTreeDecompositionDP();
+    
     return 0;
 }
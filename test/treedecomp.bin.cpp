@@ -0,0 +1,400 @@
+#include "test.hpp"
+
+#include "mao/treedecomp.hpp"
+#include "mao/treedecomp_dist.hpp"
+
+using namespace treedecomp;
+
+namespace {
+
+template <int N>
+Seq<N> randomPermutation(int length) {
+    vector<int> perm(length);
+    for(int i = 0; i < length; ++i) {
+        perm[i] = i;
+    }
+    shuffle(perm.begin(), perm.end(), rng);
+    Seq<N> ret;
+    for(int i = 0; i < length; ++i) {
+        ret[i] = perm[i];
+    }
+    return ret;
+}
+
+template <int N>
+void checkSameResult(const typename Contractor<N>::Result& a, const typename Contractor<N>::Result& b) {
+    checkTrue(a.seq == b.seq);
+    checkEqual(a.origLostPred, b.origLostPred);
+    checkEqual(a.chosenMask, b.chosenMask);
+}
+
+// The kernel selected for the target, which is the SIMD kernel on targets
+// with AVX-512 VBMI2, and the exact-size kernels must agree with the generic
+// contraction. The exact-size kernels are called directly, as they are not
+// selected on targets with a SIMD kernel.
+template <int N>
+void test_Contractor() {
+    typedef BP<N> B;
+    for(int srcSize = 0; srcSize <= N; ++srcSize) {
+        for(int t = 0; t < 20; ++t) {
+            B mask = setIntersection(B::random(), B::range(srcSize));
+            Contractor<N> contractor(srcSize, mask);
+            Seq<N> seq = randomPermutation<N>(srcSize);
+            
+            typename Contractor<N>::Result expected = Contractor<N>::contractGeneric(contractor, seq);
+            B chosenMask;
+            for(int i = 0; i < srcSize; ++i) {
+                if(mask.has(seq[i])) {
+                    chosenMask.add(i);
+                }
+            }
+            checkEqual(expected.chosenMask, chosenMask);
+            
+            checkSameResult<N>(contractor(seq), expected);
+            if(srcSize < exactKernelCount<N>()) {
+                checkSameResult<N>(Contractor<N>::exactKernel(srcSize)(contractor, seq), expected);
+            }
+        }
+    }
+}
+
+// Ranking the permutations of each length in lexicographic order gives
+// consecutive ranks, and unranking inverts ranking.
+template <int N>
+void test_RankedStateCodec() {
+    typedef BP<N> B;
+    for(int length = 0; length <= N; ++length) {
+        RankedStateCodec<N> codec(length);
+        if(length <= 7) {
+            Seq<N> seq;
+            for(int i = 0; i < length; ++i) {
+                seq[i] = i;
+            }
+            uint64_t rank = 0;
+            do {
+                uint64_t key = codec.first(seq);
+                checkEqual(key, rank << N);
+                checkTrue(codec.seq(key) == seq);
+                ++rank;
+            } while(next_permutation(seq.elems, seq.elems + length));
+        }
+        for(int t = 0; t < 100; ++t) {
+            Seq<N> seq = randomPermutation<N>(length);
+            B lostPred = setIntersection(B::random(), B::range(length));
+            uint64_t key = codec.withLostPred(codec.first(seq), lostPred);
+            checkTrue(codec.seq(key) == seq);
+            checkEqual(codec.lostPred(key), lostPred);
+            checkTrue(codec.sameSeq(key, codec.first(seq)));
+            checkTrue(codec.first(seq) <= key && key <= codec.last(seq));
+        }
+    }
+}
+
+template <typename Dist, typename Codec>
+void writeDist(const string& path, const Dist& dist, const Codec& codec, int length) {
+    CheckpointWriter out(path);
+    writeCheckpointDist(out, dist, codec, length);
+    out.commit();
+}
+
+template <typename Dist, typename Codec>
+Dist readDist(const string& path, const Codec& codec, int length) {
+    CheckpointReader in(path);
+    checkTrue(in.isOpen());
+    Dist ret = readCheckpointDist<Dist>(in, codec, length);
+    in.finish();
+    return ret;
+}
+
+// The checkpoint format does not depend on the keys, so a distribution saved
+// with the ranked keys loads with the plain keys and vice versa.
+template <int N>
+void test_checkpointCodecs() {
+    typedef BP<N> B;
+    typedef map<uint64_t, Z> RankedDist;
+    typedef map<pair<Seq<N>, B>, Z> PlainDist;
+    
+    char dirTemplate[] = "/tmp/count_mao_codec_XXXXXX";
+    checkTrue(mkdtemp(dirTemplate) != nullptr);
+    string path = string(dirTemplate) + "/dist.ckpt";
+    
+    for(int length = 0; length <= N; ++length) {
+        RankedStateCodec<N> ranked(length);
+        PlainStateCodec<N> plain(length);
+        for(int t = 0; t < 5; ++t) {
+            RankedDist rankedDist;
+            PlainDist plainDist;
+            int stateCount = UnifInt<int>(0, 50)(rng);
+            for(int i = 0; i < stateCount; ++i) {
+                Seq<N> seq = randomPermutation<N>(length);
+                B lostPred = setIntersection(B::random(), B::range(length));
+                Z count = UnifInt<int>(1, 1000000)(rng);
+                rankedDist[ranked.withLostPred(ranked.first(seq), lostPred)] = count;
+                plainDist[plain.withLostPred(plain.first(seq), lostPred)] = count;
+            }
+            
+            writeDist(path, rankedDist, ranked, length);
+            checkTrue(readDist<PlainDist>(path, plain, length) == plainDist);
+            checkTrue(readDist<RankedDist>(path, ranked, length) == rankedDist);
+            
+            writeDist(path, plainDist, plain, length);
+            checkTrue(readDist<RankedDist>(path, ranked, length) == rankedDist);
+        }
+    }
+    
+    checkEqual(unlink(path.c_str()), 0);
+    checkEqual(rmdir(dirTemplate), 0);
+}
+
+// Random states of sequences of the given length with positive counts.
+template <int N>
+Dist<N> randomDist(int length, int maxCount) {
+    StateCodec<N> codec(length);
+    Dist<N> ret;
+    int count = UnifInt<int>(0, maxCount)(rng);
+    for(int i = 0; i < count; ++i) {
+        BP<N> lostPred = setIntersection(BP<N>::random(), BP<N>::range(length));
+        ret[codec.withLostPred(codec.first(randomPermutation<N>(length)), lostPred)] = UnifInt<int>(1, 1000)(rng);
+    }
+    return ret;
+}
+
+// The distribution of a leaf with a output vertices 0, ..., a - 1 and b extra
+// vertices, counted over all the orderings of the a + b vertices. An output
+// vertex has lost its predecessor if an extra vertex precedes it.
+template <int N>
+Dist<N> materializedLeafDist(int a, int b) {
+    StateCodec<N> codec(a);
+    Dist<N> ret;
+    vector<int> order(a + b);
+    for(int i = 0; i < a + b; ++i) {
+        order[i] = i;
+    }
+    do {
+        Seq<N> seq;
+        BP<N> lostPred;
+        int pos = 0;
+        bool extraSeen = false;
+        for(int v : order) {
+            if(v >= a) {
+                extraSeen = true;
+            } else {
+                seq[pos] = v;
+                if(extraSeen) {
+                    lostPred.add(pos);
+                }
+                ++pos;
+            }
+        }
+        ++ret[codec.withLostPred(codec.first(seq), lostPred)];
+    } while(next_permutation(order.begin(), order.end()));
+    return ret;
+}
+
+template <int N, typename ADist, typename BDist>
+Dist<N> combineSparse(const ADist& a, const BDist& b, int vertCount, BP<N> bMask, BP<N> outputMask) {
+    CombineCounts counts;
+    return get<Dist<N>>(combine<N>(a, b, vertCount, bMask, outputMask, false, counts));
+}
+
+// A random set of size elements of the first n positions.
+template <int N>
+BP<N> randomSubset(int n, int size) {
+    vector<int> positions(n);
+    for(int i = 0; i < n; ++i) {
+        positions[i] = i;
+    }
+    shuffle(positions.begin(), positions.end(), rng);
+    BP<N> ret;
+    for(int i = 0; i < size; ++i) {
+        ret.add(positions[i]);
+    }
+    return ret;
+}
+
+// A LeafDist expands to the states of the materialized leaf distribution, and
+// combining it with another distribution on either side gives the same output.
+template <int N>
+void test_LeafDist() {
+    typedef BP<N> B;
+    const int MaxLeafSize = min(N, 8);
+    for(int a = 0; a <= MaxLeafSize; ++a) {
+        for(int b = 0; a + b <= MaxLeafSize; ++b) {
+            LeafDist<N> leaf(a, b);
+            Dist<N> materialized = materializedLeafDist<N>(a, b);
+            
+            StateCodec<N> codec(a);
+            Dist<N> expanded;
+            forEachSeqGroup<N>(leaf, codec, [&](const Seq<N>& seq, SeqGroupStates<N, LeafDist<N>> states) {
+                states([&](B lostPred, const Z& count) {
+                    checkTrue(expanded.emplace(codec.withLostPred(codec.first(seq), lostPred), count).second);
+                });
+            });
+            checkTrue(expanded == materialized);
+            checkEqual(leaf.size(), (uint64_t)materialized.size());
+            checkEqual(leaf.total(), factorial(a + b));
+            
+            for(int t = 0; t < 3; ++t) {
+                B bMask = setIntersection(B::random(), B::range(a));
+                B outputMask = setIntersection(B::random(), B::range(a));
+                Dist<N> other = randomDist<N>(bMask.count(), 30);
+                checkTrue(
+                    combineSparse<N>(leaf, other, a, bMask, outputMask) ==
+                    combineSparse<N>(materialized, other, a, bMask, outputMask)
+                );
+                
+                int vertCount = UnifInt<int>(a, MaxLeafSize)(rng);
+                bMask = randomSubset<N>(vertCount, a);
+                outputMask = setIntersection(B::random(), B::range(vertCount));
+                other = randomDist<N>(vertCount, 30);
+                checkTrue(
+                    combineSparse<N>(other, leaf, vertCount, bMask, outputMask) ==
+                    combineSparse<N>(other, materialized, vertCount, bMask, outputMask)
+                );
+            }
+        }
+    }
+}
+
+template <int N>
+DenseDist<N> denseDist(const Dist<N>& dist, int length) {
+    DenseDist<N> ret(length);
+    for(const pair<const uint64_t, Z>& state : dist) {
+        ret.counts[ret.index(state.first)] = state.second;
+        ++ret.stateCount;
+    }
+    return ret;
+}
+
+// Combining with dense inputs or into a dense output gives the same states as
+// the sparse combine.
+template <int N>
+void test_DenseDist() {
+    typedef BP<N> B;
+    for(int t = 0; t < 100; ++t) {
+        int vertCount = UnifInt<int>(0, min(N, 6))(rng);
+        B bMask = setIntersection(B::random(), B::range(vertCount));
+        B outputMask = setIntersection(B::random(), B::range(vertCount));
+        int bLength = bMask.count();
+        
+        Dist<N> a = randomDist<N>(vertCount, 200);
+        Dist<N> b = randomDist<N>(bLength, 50);
+        DenseDist<N> aDense = denseDist<N>(a, vertCount);
+        DenseDist<N> bDense = denseDist<N>(b, bLength);
+        checkTrue(sparseDist<N>(aDense) == a);
+        Z aTotal = 0;
+        for(const pair<const uint64_t, Z>& state : a) {
+            aTotal += state.second;
+        }
+        checkEqual(aDense.total(), aTotal);
+        
+        Dist<N> expected = combineSparse<N>(a, b, vertCount, bMask, outputMask);
+        checkTrue(combineSparse<N>(aDense, b, vertCount, bMask, outputMask) == expected);
+        checkTrue(combineSparse<N>(a, bDense, vertCount, bMask, outputMask) == expected);
+        checkTrue(combineSparse<N>(aDense, bDense, vertCount, bMask, outputMask) == expected);
+        
+        CombineCounts counts;
+        DenseDist<N> dense = get<DenseDist<N>>(combine<N>(aDense, bDense, vertCount, bMask, outputMask, true, counts));
+        checkTrue(sparseDist<N>(dense) == expected);
+        checkEqual(dense.size(), (uint64_t)expected.size());
+    }
+}
+
+// Random distinct sets of lost predecessors in the first length positions
+// with positive counts.
+template <int N>
+map<BP<N>, Z> randomStates(int length, int maxCount) {
+    typedef BP<N> B;
+    map<B, Z> ret;
+    int count = UnifInt<int>(0, maxCount)(rng);
+    for(int i = 0; i < count; ++i) {
+        ret[setIntersection(B::random(), B::range(length))] = UnifInt<int>(1, 1000)(rng);
+    }
+    return ret;
+}
+
+// The subset convolution of a sequence group gives the same sums as going
+// through the pairs of states with disjoint sets of lost predecessors.
+template <int N>
+void test_convolveSeqGroup() {
+    typedef BP<N> B;
+    for(int t = 0; t < 200; ++t) {
+        int vertCount = UnifInt<int>(0, min(N, MaxSubsetConvolutionSize))(rng);
+        B bMask = setIntersection(B::random(), B::range(vertCount));
+        typename Contractor<N>::Result bContraction = Contractor<N>(vertCount, bMask)(randomPermutation<N>(vertCount));
+        
+        map<B, Z> aStates = randomStates<N>(vertCount, 20);
+        map<B, Z> bStates = randomStates<N>(bMask.count(), 20);
+        vector<B> bPackedLostPreds;
+        vector<const Z*> bCounts;
+        for(const pair<const B, Z>& state : bStates) {
+            bPackedLostPreds.push_back(state.first);
+            bCounts.push_back(&state.second);
+        }
+        
+        map<B, Z> expected;
+        uint64_t pairCount = 0;
+        for(const pair<const B, Z>& b : bStates) {
+            B bLostPred = B::unpack(b.first, bContraction.chosenMask);
+            if(!setIntersection(bLostPred, bContraction.origLostPred).isEmpty()) {
+                continue;
+            }
+            for(const pair<const B, Z>& a : aStates) {
+                ++pairCount;
+                if(setIntersection(a.first, bLostPred).isEmpty()) {
+                    expected[setUnion(a.first, bLostPred)] += a.second * b.second;
+                }
+            }
+        }
+        
+        auto forEachAState = [&](auto g) {
+            for(const pair<const B, Z>& state : aStates) {
+                g(state.first, state.second);
+            }
+        };
+        map<B, Z> result;
+        bool convolved = convolveSeqGroup<N>(
+            forEachAState, bPackedLostPreds, bCounts, bContraction, 0.0,
+            [&](B lostPred, Z count) {
+                checkTrue(result.emplace(lostPred, count).second);
+            }
+        );
+        checkEqual(convolved, pairCount > 0);
+        if(convolved) {
+            checkTrue(result == expected);
+        }
+    }
+}
+
+}
+
+int main() {
+    test_Contractor<1>();
+    test_Contractor<8>();
+    test_Contractor<16>();
+    test_Contractor<64>();
+    test_Contractor<128>();
+    test_Contractor<512>();
+    
+    test_RankedStateCodec<1>();
+    test_RankedStateCodec<4>();
+    test_RankedStateCodec<8>();
+    test_RankedStateCodec<16>();
+    
+    test_checkpointCodecs<1>();
+    test_checkpointCodecs<8>();
+    test_checkpointCodecs<16>();
+    
+    test_LeafDist<8>();
+    test_LeafDist<16>();
+    test_LeafDist<64>();
+    
+    test_DenseDist<8>();
+    test_DenseDist<16>();
+    
+    test_convolveSeqGroup<8>();
+    test_convolveSeqGroup<16>();
+    test_convolveSeqGroup<64>();
+    
+    return 0;
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <climits>
+#include <cstring>
+
+// Bits 0, 2, ..., 30 of x packed into the low 16 bits.
+inline uint32_t packEvenBits(uint32_t x) {
+#ifdef __BMI2__
+    return _pext_u32(x, 0x55555555);
+#else
+    x &= 0x55555555;
+    x = (x | (x >> 1)) & 0x33333333;
+    x = (x | (x >> 2)) & 0x0F0F0F0F;
+    x = (x | (x >> 4)) & 0x00FF00FF;
+    return (x | (x >> 8)) & 0x0000FFFF;
+#endif
+}
+
+// The low four bits of x moved to bits 0, 16, 32 and 48.
+inline uint64_t spreadNibble16(uint64_t x) {
+#ifdef __BMI2__
+    return _pdep_u64(x, UINT64_C(0x0001000100010001));
+#else
+    return (x & 1) | ((x & 2) << 15) | ((x & 4) << 30) | ((x & 8) << 45);
+#endif
+}
+
+// Parses text from memory without going through the formatted stream
+// operations. Either reads the rest of an input stream into memory or uses a
+// buffer owned by the caller.
+class TextInput {
+public:
+    explicit TextInput(istream& in) : pos_(0) {
+        const size_t ChunkSize = (size_t)1 << 20;
+        size_t size = 0;
+        while(true) {
+            ownedBuf_.resize(size + ChunkSize);
+            in.read(ownedBuf_.data() + size, ChunkSize);
+            size += in.gcount();
+            if(!in) {
+                break;
+            }
+        }
+        if(in.bad()) {
+            fail("Reading input failed");
+        }
+        in.clear(in.eofbit);
+        ownedBuf_.resize(size);
+        data_ = ownedBuf_.data();
+        size_ = size;
+    }
+    
+    TextInput(const char* data, size_t size)
+        : data_(data),
+          size_(size),
+          pos_(0)
+    { }
+    
+    TextInput(const TextInput&) = delete;
+    TextInput& operator=(const TextInput&) = delete;
+    
+    bool atEnd() {
+        skipWhitespace();
+        return pos_ == size_;
+    }
+    
+    int readInt() {
+        skipWhitespace();
+        bool negative = false;
+        if(pos_ != size_ && data_[pos_] == '-') {
+            negative = true;
+            ++pos_;
+        }
+        if(pos_ == size_ || !isDigit_(data_[pos_])) {
+            fail("Invalid input: expected an integer");
+        }
+        int64_t ret = 0;
+        while(pos_ != size_ && isDigit_(data_[pos_])) {
+            ret = 10 * ret + (data_[pos_] - '0');
+            if(ret > INT_MAX) {
+                fail("Invalid input: integer too large");
+            }
+            ++pos_;
+        }
+        checkTokenEnd_();
+        return negative ? -(int)ret : (int)ret;
+    }
+    
+    // Reads count whitespace-separated 0/1 values to the bits of row, which
+    // must have at least (count + 63) / 64 words and is overwritten.
+    void readBitRow(uint64_t* row, int count) {
+        fill(row, row + ((count + 63) >> 6), 0);
+        
+        int j = 0;
+        while(j < count) {
+            skipWhitespace();
+#ifdef __AVX2__
+            // Fast path for runs of 16 single-digit values separated by single
+            // whitespace characters
+            while(count - j >= 16 && size_ - pos_ >= 32) {
+                __m256i v = _mm256_loadu_si256((const __m256i*)(data_ + pos_));
+                uint32_t one = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('1')));
+                uint32_t zero = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('0')));
+                uint32_t space = _mm256_movemask_epi8(_mm256_or_si256(
+                    _mm256_or_si256(
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))
+                    ),
+                    _mm256_or_si256(
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))
+                    )
+                ));
+                const uint32_t Even = 0x55555555;
+                if(((one | zero) & Even) != Even || (space & ~Even) != ~Even) {
+                    break;
+                }
+                uint64_t bits = packEvenBits(one);
+                row[j >> 6] |= bits << (j & 63);
+                if((j & 63) > 48) {
+                    row[(j >> 6) + 1] |= bits >> (64 - (j & 63));
+                }
+                j += 16;
+                pos_ += 32;
+            }
+            if(j == count) {
+                break;
+            }
+            skipWhitespace();
+#endif
+            if(pos_ == size_) {
+                fail("Invalid input: unexpected end of input");
+            }
+            char c = data_[pos_];
+            if(c != '0' && c != '1') {
+                fail("Invalid input: expected 0 or 1");
+            }
+            ++pos_;
+            checkTokenEnd_();
+            row[j >> 6] |= (uint64_t)(c - '0') << (j & 63);
+            ++j;
+        }
+    }
+    
+    // If the next token is exactly token, consumes it and returns true.
+    // Otherwise, leaves the input unchanged and returns false.
+    bool tryReadToken(const char* token) {
+        skipWhitespace();
+        size_t len = strlen(token);
+        if(
+            size_ - pos_ < len || memcmp(data_ + pos_, token, len) ||
+            (size_ - pos_ > len && !isWhitespace_(data_[pos_ + len]))
+        ) {
+            return false;
+        }
+        pos_ += len;
+        return true;
+    }
+    
+    void skipWhitespace() {
+        while(pos_ != size_ && isWhitespace_(data_[pos_])) {
+            ++pos_;
+        }
+    }
+    
+private:
+    vector<char> ownedBuf_;
+    const char* data_;
+    size_t size_;
+    size_t pos_;
+    
+    static bool isDigit_(char c) {
+        return c >= '0' && c <= '9';
+    }
+    static bool isWhitespace_(char c) {
+        return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+    }
+    
+    void checkTokenEnd_() {
+        if(pos_ != size_ && !isWhitespace_(data_[pos_])) {
+            fail("Invalid input: unexpected character '", data_[pos_], "'");
+        }
+    }
+};
+
+// Appends the first count bits of row to out as space-separated 0/1 values
+// followed by a newline.
+inline void appendBitRow(string& out, const uint64_t* row, int count) {
+    if(count == 0) {
+        out.push_back('\n');
+        return;
+    }
+    
+    size_t start = out.size();
+    out.resize(start + 2 * (size_t)count + 8);
+    char* p = &out[start];
+    
+    // Each group of four bits expands to the eight characters "b b b b "
+    for(int j = 0; j < count; j += 4) {
+        uint64_t bits = (row[j >> 6] >> (j & 63)) & 15;
+        uint64_t chars = UINT64_C(0x2030203020302030) | spreadNibble16(bits);
+        memcpy(p + 2 * j, &chars, 8);
+    }
+    
+    out.resize(start + 2 * (size_t)count);
+    out.back() = '\n';
+}